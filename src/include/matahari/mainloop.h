@@ -31,6 +31,9 @@ extern "C" {
 
 #include <glib.h>
 #include <sys/types.h>
+#ifndef WIN32
+#include <sys/resource.h>
+#endif
 
 gboolean
 mainloop_signal(int sig, void (*dispatch)(int sig));
@@ -88,6 +91,10 @@ struct mainloop_child_s {
     unsigned  timerid;
     gboolean  timeout;
     void     *privatedata;
+#ifndef WIN32
+    /* Resources used by the process, valid once it has died */
+    struct rusage rusage;
+#endif
 
     /* Called when a process dies */
     void (*callback)(mainloop_child_t* p, int status, int signo, int exitcode);
@@ -39,6 +39,12 @@ extern "C" {
 
 #define SYSTEMCTL "/bin/systemctl"
 
+/** Where LSB services conventionally record their pid */
+#define LSB_PID_DIR "/var/run"
+
+/** Default limit on the number of actions executing at once */
+#define SERVICES_DEFAULT_MAX_CONCURRENT 8
+
 enum lsb_exitcode {
     LSB_OK = 0,
     LSB_UNKNOWN_ERROR = 1,
@@ -195,6 +201,49 @@ resources_list_agents(const char *standard, const char *provider);
 GList *
 resources_list_standards(void);
 
+/**
+ * Get the meta-data of a resource agent
+ *
+ * The agent is only executed if it has changed since its meta-data was
+ * last obtained, through this call or a meta-data action.  Otherwise the
+ * cached copy is returned, which is also kept across restarts under
+ * LOCAL_STATE_DIR/lib/matahari/metadata.
+ *
+ * \param[in] standard the agent's standard, only "ocf" is supported
+ * \param[in] provider the agent's provider
+ * \param[in] agent    the agent's name
+ *
+ * \return the meta-data XML, to be freed with free(), or NULL on failure
+ */
+char *
+resources_get_metadata(const char *standard, const char *provider,
+                       const char *agent);
+
+/**
+ * Get the meta-data of a resource agent without blocking
+ *
+ * Like resources_get_metadata(), but the agent, if it has to be executed,
+ * is run as an asynchronous action and the result is passed to \p callback
+ * from the mainloop, even if it was cached.
+ *
+ * \param[in] standard  the agent's standard, only "ocf" is supported
+ * \param[in] provider  the agent's provider
+ * \param[in] agent     the agent's name
+ * \param[in] callback  called with the meta-data XML, or NULL on failure.
+ *                      The XML is only valid for the duration of the call.
+ * \param[in] user_data passed to \p callback
+ *
+ * \retval TRUE  the callback will be invoked
+ * \retval FALSE the meta-data could not be requested, no callback will be
+ *               received
+ */
+gboolean
+resources_get_metadata_async(const char *standard, const char *provider,
+                             const char *agent,
+                             void (*callback)(const char *xml,
+                                              void *user_data),
+                             void *user_data);
+
 svc_action_t *
 services_action_create(const char *name, const char *action,
                        int interval /* ms */, int timeout /* ms */);
@@ -242,15 +291,401 @@ services_action_sync(svc_action_t *op);
  * \param[in] op services action data
  * \param[in] action_callback callback for when the action completes
  *
- * \retval TRUE succesfully started execution
+ * The action may be queued rather than started straight away, see
+ * services_set_max_concurrent().  If a queued action later fails to start,
+ * the callback is invoked with status LRM_OP_ERROR.  If it is cancelled
+ * with services_action_cancel() while still queued, the callback is invoked
+ * with status LRM_OP_CANCELLED.
+ *
+ * \retval TRUE succesfully started or queued execution
  * \retval FALSE failed to start execution, no callback will be received
  */
 gboolean
 services_action_async(svc_action_t *op, void (*action_callback)(svc_action_t *));
 
+/**
+ * Get how long an asynchronous action was queued and how long it ran.
+ *
+ * Both are 0 for actions that were completed with a shared or cached
+ * result instead of being executed.
+ *
+ * \param[in]  op      services action data
+ * \param[out] wait_ms time spent waiting for an execution slot, in ms
+ * \param[out] run_ms  time spent executing, in ms
+ */
+void
+services_action_get_timing(svc_action_t *op, unsigned int *wait_ms,
+                           unsigned int *run_ms);
+
+/**
+ * Resources consumed by an executed action.
+ */
+typedef struct services_usage_s {
+    /** Time from the action starting to its completion, in milliseconds */
+    unsigned int wall_ms;
+    /** CPU time spent in user mode, in milliseconds */
+    unsigned int user_ms;
+    /** CPU time spent in the kernel, in milliseconds */
+    unsigned int system_ms;
+    /** Largest resident set size of the agent or its children, in KiB */
+    guint64 max_rss_kb;
+    /** Bytes read from storage */
+    guint64 read_bytes;
+    /** Bytes written to storage */
+    guint64 write_bytes;
+} services_usage_t;
+
+/**
+ * Get the resources consumed by an action that has completed.
+ *
+ * CPU, memory and I/O figures include the agent and any descendants it
+ * waited for, and are 0 for actions not run as a process, such as systemd
+ * units controlled over D-Bus.  Everything is 0 for actions that were
+ * completed with a shared or cached result.
+ *
+ * \param[in]  op    services action data
+ * \param[out] usage the resources used
+ */
+void
+services_action_get_usage(svc_action_t *op, services_usage_t *usage);
+
+/**
+ * Resources consumed by all of the actions of one resource agent.
+ */
+typedef struct services_agent_usage_s {
+    /** The agent, as "standard:provider:agent" or "standard:agent" */
+    char *agent;
+    /** Number of actions executed */
+    guint64 actions;
+    /** Totals over all of those actions */
+    guint64 wall_ms;
+    guint64 user_ms;
+    guint64 system_ms;
+    guint64 read_bytes;
+    guint64 write_bytes;
+    /** Largest max_rss_kb of any one action */
+    guint64 max_rss_kb;
+} services_agent_usage_t;
+
+/**
+ * Get the resources consumed by each agent since the library was loaded.
+ *
+ * \return a list of services_agent_usage_t *, most CPU time first.  The
+ *         list must be freed with services_agent_usage_free().
+ */
+GList *
+services_get_agent_usage(void);
+
+/**
+ * Free a list returned by services_get_agent_usage().
+ */
+void
+services_agent_usage_free(GList *usage);
+
+/** Number of results kept for each resource, see services_get_history() */
+#define SERVICES_HISTORY_LENGTH 32
+/** Longest action name kept in a history record, including the NUL */
+#define SERVICES_HISTORY_ACTION_MAX 24
+/** Most stderr kept in a history record, including the NUL */
+#define SERVICES_HISTORY_STDERR_MAX 128
+
+/**
+ * The result of one action on a resource.
+ */
+typedef struct services_history_s {
+    /** When the action completed, in seconds since the epoch */
+    gint64 timestamp;
+    /** Time the action spent executing, in milliseconds */
+    unsigned int duration_ms;
+    /** Interval of a recurring action, or 0 */
+    unsigned int interval;
+    int rc;
+    int status;
+    char action[SERVICES_HISTORY_ACTION_MAX];
+    /** The end of the action's stderr, if any */
+    char stderr_tail[SERVICES_HISTORY_STDERR_MAX];
+} services_history_t;
+
+/**
+ * Get the most recent results of actions on a resource.
+ *
+ * The last SERVICES_HISTORY_LENGTH results of each resource are kept in
+ * memory, whether the action was executed or completed with a shared or
+ * cached result.  Results of cancelled actions are not kept.
+ *
+ * \param[in]  name    the resource, as given to resources_action_create()
+ * \param[out] records filled in with the results, most recent first
+ * \param[in]  max     room in \p records
+ *
+ * \return the number of records filled in
+ */
+unsigned int
+services_get_history(const char *name, services_history_t *records,
+                     unsigned int max);
+
+/** Default amount of output kept in memory by a streaming action */
+#define SERVICES_DEFAULT_OUTPUT_TAIL 4096
+
+/**
+ * Stream the output of an asynchronous action as it is produced.
+ *
+ * The callback receives stdout and stderr in chunks of complete lines,
+ * each ending with a newline, except for a final unterminated line when
+ * the agent exits and very long lines, which are split.  Once streaming,
+ * op->stdout_data and op->stderr_data only keep the last \p tail bytes
+ * of output, so that long running agents are not buffered in full.
+ *
+ * Must be called before services_action_async().  It has no effect on
+ * synchronous actions.
+ *
+ * \param[in] op              services action data
+ * \param[in] output_callback called with each chunk of output
+ * \param[in] tail            output to keep in the action, in bytes, or 0
+ *                            for SERVICES_DEFAULT_OUTPUT_TAIL
+ */
+void
+services_action_stream_output(svc_action_t *op,
+                              void (*output_callback)(svc_action_t *op,
+                                                      gboolean is_stderr,
+                                                      const char *data,
+                                                      size_t len),
+                              size_t tail);
+
+/**
+ * Cancel a recurring or queued action.
+ *
+ * An action that is currently executing is allowed to finish, but its
+ * result is discarded and it will not be rescheduled.
+ *
+ * \retval TRUE the action was found and cancelled
+ * \retval FALSE no such action
+ */
 gboolean
 services_action_cancel(const char *name, const char *action, int interval);
 
+/**
+ * Cancel every recurring action of a resource.
+ *
+ * \param[in] name the resource name the actions were created with
+ *
+ * \return the number of actions cancelled
+ */
+unsigned int
+services_action_cancel_all(const char *name);
+
+/**
+ * Get the recurring actions currently scheduled.
+ *
+ * \return a list of svc_action_t *.  The actions remain owned by the
+ *         services library, the list must be freed with g_list_free().
+ */
+GList *
+services_action_list_recurring(void);
+
+/**
+ * A group of actions executed in dependency order, see services_group_new().
+ */
+typedef struct services_group_s services_group_t;
+
+/**
+ * The result of one member of a group.
+ */
+typedef struct services_group_result_s {
+    /** The member's resource name */
+    char *name;
+    int rc;
+    int status;
+    /** TRUE if not executed because a member it depends on failed */
+    gboolean skipped;
+    /** When the action was submitted, in ms after the group started */
+    unsigned int start_ms;
+    /** Time from submitting the action to its completion, in ms */
+    unsigned int run_ms;
+} services_group_result_t;
+
+/**
+ * Create a group of actions to be executed in dependency order.
+ *
+ * Members are added with services_group_add() and executed with
+ * services_group_run().  A member is executed once every member it must
+ * come after has succeeded, so independent members run in parallel.  If a
+ * member fails, every member that depends on it is skipped.
+ *
+ * \param[in] reverse        TRUE to reverse the ordering constraints, so
+ *                           that the same constraints serve to start and
+ *                           to stop a group of services
+ * \param[in] max_concurrent most members to execute at once, or 0 for no
+ *                           limit other than services_set_max_concurrent()
+ */
+services_group_t *
+services_group_new(gboolean reverse, unsigned int max_concurrent);
+
+/**
+ * Add a one-shot action to a group.
+ *
+ * The group takes ownership of the action, even if it cannot be added,
+ * and uses its cb_data.
+ *
+ * \param[in] group the group
+ * \param[in] op    the action, identified within the group by op->rsc
+ * \param[in] after names of the members that must succeed before this one
+ *                  is executed.  The list is copied.
+ *
+ * \retval TRUE the action was added
+ * \retval FALSE the group already has a member with that name
+ */
+gboolean
+services_group_add(services_group_t *group, svc_action_t *op, GList *after);
+
+/**
+ * Execute the members of a group.
+ *
+ * \param[in] group     the group
+ * \param[in] callback  invoked from the mainloop once every member has
+ *                      completed or been skipped
+ * \param[in] user_data passed to the callback
+ *
+ * \retval TRUE the group was started
+ * \retval FALSE a member depends on an unknown member, or the ordering
+ *         constraints form a cycle.  The callback will not be invoked.
+ */
+gboolean
+services_group_run(services_group_t *group,
+                   void (*callback)(services_group_t *group, void *user_data),
+                   void *user_data);
+
+/**
+ * Get the results of a group that has completed.
+ *
+ * \return a list of const services_group_result_t *, in the order the
+ *         members were added.  The results remain owned by the group, the
+ *         list must be freed with g_list_free().
+ */
+GList *
+services_group_results(services_group_t *group);
+
+/**
+ * Get the timing of a group that has completed.
+ *
+ * The critical path is the chain of dependent members that took longest.
+ * With enough parallelism, the group cannot complete faster than it.
+ *
+ * \param[in]  group         the group
+ * \param[out] elapsed_ms    time taken by the whole group, in ms
+ * \param[out] critical_ms   time taken by the critical path, in ms
+ * \param[out] critical_path if not NULL, set to the names of the members
+ *                           on the critical path, in order of execution.
+ *                           Free the list with g_list_free().
+ */
+void
+services_group_timing(services_group_t *group, unsigned int *elapsed_ms,
+                      unsigned int *critical_ms, GList **critical_path);
+
+/**
+ * Free a group, either once its callback has been invoked or instead of
+ * running it.
+ */
+void
+services_group_free(services_group_t *group);
+
+/**
+ * Statistics on the scheduling of asynchronous actions.
+ */
+typedef struct services_stats_s {
+    /** Number of actions waiting for an execution slot */
+    unsigned int queued;
+    /** Number of actions currently executing */
+    unsigned int running;
+    /** Maximum number of actions allowed to execute at once */
+    unsigned int max_concurrent;
+    /** Number of actions that have been started */
+    guint64 dispatched;
+    /** Average time, in milliseconds, actions spent waiting to start */
+    unsigned int wait_avg;
+    /** Longest time, in milliseconds, an action spent waiting to start */
+    unsigned int wait_max;
+} services_stats_t;
+
+/**
+ * Limit the number of asynchronous actions executing at once.
+ *
+ * Actions requested with services_action_async() beyond this limit are
+ * queued.  Actions such as start and stop are run ahead of others, and
+ * recurring actions are run last.  Actions for the same resource are
+ * always executed one at a time.
+ *
+ * \param[in] max maximum number of concurrent actions, or 0 to use
+ *            SERVICES_DEFAULT_MAX_CONCURRENT
+ */
+void
+services_set_max_concurrent(unsigned int max);
+
+/**
+ * Reuse the results of status and monitor actions.
+ *
+ * Identical read-only actions (status, monitor and meta-data with the same
+ * standard, provider, agent and parameters) requested asynchronously while
+ * one is already in progress always share its result.  In addition, with a
+ * non-zero TTL, a completed status or monitor result is handed to identical
+ * requests for that long instead of executing the agent again.
+ *
+ * \param[in] ttl how long to reuse a result, in milliseconds. 0 disables.
+ */
+void
+services_set_result_ttl(unsigned int ttl);
+
+/**
+ * Be told as soon as the main process of a service exits.
+ *
+ * The process is the MainPID of the systemd unit or, failing that, the
+ * one named by the service's pidfile in LSB_PID_DIR, see
+ * services_set_lsb_pidfile_status().  It is watched from the mainloop
+ * without polling.  The watch ends when the callback is invoked; watching
+ * a service again replaces the previous watch.
+ *
+ * \param[in] name      the service
+ * \param[in] callback  invoked with the name and pid once the process exits
+ * \param[in] user_data passed to the callback
+ *
+ * \return the pid being watched, or 0 if the service's process could not
+ *         be found or cannot be watched
+ */
+pid_t
+services_watch(const char *name,
+               void (*callback)(const char *name, pid_t pid, void *user_data),
+               void *user_data);
+
+/**
+ * Stop watching a service.
+ *
+ * \retval TRUE the watch was removed, its callback will not be invoked
+ * \retval FALSE the service was not being watched
+ */
+gboolean
+services_unwatch(const char *name);
+
+/**
+ * Answer LSB status actions from the service's pidfile when possible.
+ *
+ * When enabled, a status action on an LSB service first reads
+ * LSB_PID_DIR/<service>.pid.  If the process it names is alive and is
+ * the service itself, LSB_STATUS_OK is returned without running the init
+ * script.  In every other case, the script is run as usual.
+ *
+ * \param[in] enabled TRUE to use pidfiles, FALSE (the default) to always
+ *            run the init script
+ */
+void
+services_set_lsb_pidfile_status(gboolean enabled);
+
+/**
+ * Get statistics on the scheduling of asynchronous actions.
+ *
+ * \param[out] stats the current statistics
+ */
+void
+services_get_stats(services_stats_t *stats);
+
 static inline enum ocf_exitcode
 services_get_ocf_exitcode(char *action, int lsb_exitcode)
 {
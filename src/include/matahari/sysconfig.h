@@ -42,7 +42,10 @@ extern "C" {
  * Callback for run_uri or run_string requests.
  *
  * \param[in] data cb_data provided with a run_string or run_uri request
- * \param[in] res exit code from executed request
+ * \param[in] res exit code from executed request, or the negated enum
+ *            mh_result if the request failed before anything was executed
+ *            (for example, because the configuration could not be
+ *            downloaded)
  */
 typedef void (*mh_sysconfig_result_cb)(void *data, int res);
 
@@ -100,6 +103,38 @@ mh_sysconfig_run_string(const char *string, uint32_t flags, const char *scheme,
 char *
 mh_sysconfig_query(const char *query, uint32_t flags, const char *scheme);
 
+/**
+ * Query several configuration objects at once
+ *
+ * All queries are evaluated against the same loaded configuration tree.
+ *
+ * \param[in]  queries the query commands, as (const char *)
+ * \param[in]  flags flags used
+ * \param[in]  scheme the type of configuration, only augeas is supported
+ * \param[out] values the result of each query that matched, keyed by the
+ *             query.  Free with g_hash_table_destroy().
+ *
+ * \return See enum mh_result
+ */
+enum mh_result
+mh_sysconfig_query_batch(GList *queries, uint32_t flags, const char *scheme,
+                         GHashTable **values);
+
+/**
+ * Find the configuration objects matching a pattern
+ *
+ * \param[in]  pattern the pattern, which may contain wildcards
+ * \param[in]  flags flags used
+ * \param[in]  scheme the type of configuration, only augeas is supported
+ * \param[out] values the value of each object that matched, keyed by its
+ *             path.  Free with g_hash_table_destroy().
+ *
+ * \return See enum mh_result
+ */
+enum mh_result
+mh_sysconfig_match(const char *pattern, uint32_t flags, const char *scheme,
+                   GHashTable **values);
+
 /**
  * Set system as configured
  *
@@ -44,4 +44,17 @@
 void
 mh_sysconfig_keys_dir_set(const char *path);
 
+/**
+ * Set the directory used to cache downloaded configuration
+ *
+ * This is primarily intended to be used in unit test code.  It should not
+ * be needed by any production usage of this library.
+ *
+ * \param[in] path directory to cache downloads in
+ *
+ * \return nothing
+ */
+void
+mh_sysconfig_cache_dir_set(const char *path);
+
 #endif /* __MH_SYSCONFIG_INTERNAL_H__ */
@@ -415,7 +415,7 @@ mainloop_add_child(pid_t pid, int timeout, const char *desc, void * privatedata,
                    void (*callback)(mainloop_child_t *p, int status, int signo,
                                     int exitcode))
 {
-    mainloop_child_t *p = g_new(mainloop_child_t, 1);
+    mainloop_child_t *p = g_new0(mainloop_child_t, 1);
 
     if (mainloop_process_table == NULL) {
         mainloop_process_table = g_hash_table_new_full(
@@ -443,7 +443,8 @@ child_death_dispatch(int sig)
 {
     int status = 0;
     while (TRUE) {
-        pid_t pid = wait3(&status, WNOHANG, NULL);
+        struct rusage rusage;
+        pid_t pid = wait3(&status, WNOHANG, &rusage);
         if (pid > 0) {
             int signo = 0, exitcode = 0;
 
@@ -474,6 +475,7 @@ child_death_dispatch(int sig)
                 g_source_remove(p->timerid);
                 p->timerid = 0;
             }
+            p->rusage = rusage;
             p->callback(p, status, signo, exitcode);
             g_hash_table_remove(mainloop_process_table, GINT_TO_POINTER(pid));
             mh_trace("Removed process entry for %d", pid);
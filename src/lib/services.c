@@ -36,7 +36,112 @@ MH_TRACE_INIT_DATA(mh_services);
 /* TODO: Develop a rollover strategy */
 
 static int operations = 0;
-GHashTable *recurring_actions = NULL;
+
+/* Operation id -> recurring action */
+static GHashTable *recurring_actions = NULL;
+/* Resource name -> (operation id -> recurring action) */
+static GHashTable *recurring_by_resource = NULL;
+
+/*
+ * Asynchronous actions are not necessarily executed as soon as they are
+ * requested.  At most max_concurrent actions run at any one time, only one
+ * action per resource runs at a time and anything else waits in one of the
+ * pending queues below.  The queues are drained in order, so actions that
+ * change the state of a resource overtake routine (and recurring) checks.
+ */
+enum action_class {
+    ACTION_CLASS_URGENT = 0,
+    ACTION_CLASS_NORMAL,
+    ACTION_CLASS_RECURRING,
+    ACTION_CLASS_MAX
+};
+
+static GQueue pending_actions[ACTION_CLASS_MAX] = {
+    G_QUEUE_INIT, G_QUEUE_INIT, G_QUEUE_INIT
+};
+
+/* Resource name -> running action */
+static GHashTable *active_resources = NULL;
+static mainloop_trigger_t *dispatch_trigger = NULL;
+
+static unsigned int max_concurrent = SERVICES_DEFAULT_MAX_CONCURRENT;
+static unsigned int running_actions = 0;
+
+static guint64 dispatched_actions = 0;
+static guint64 total_wait_ms = 0;
+static unsigned int max_wait_ms = 0;
+
+static gboolean lsb_pidfile_status = FALSE;
+
+/* "standard:provider:agent" -> services_agent_usage_t */
+static GHashTable *agent_usage = NULL;
+
+/* The last results of a resource, oldest overwritten first */
+typedef struct history_ring_s {
+    services_history_t records[SERVICES_HISTORY_LENGTH];
+    unsigned int next;
+    unsigned int count;
+} history_ring_t;
+
+/* Resource name -> history_ring_t */
+static GHashTable *resource_history = NULL;
+
+/*
+ * Recurring actions that share an interval form a cohort driven by a single
+ * timer.  Each resource gets a fixed phase within the interval and is due at
+ * every multiple of the interval (on the monotonic clock) plus that phase, so
+ * actions with the same phase are launched as a batch and the interval is
+ * measured from start to start, however long each invocation takes.
+ */
+#define RECURRING_MAX_PHASES 8
+
+typedef struct recurring_cohort_s {
+    int     interval;
+    int     phases;
+    GList  *actions;
+    guint   timer;
+    gint64  armed_for;
+} recurring_cohort_t;
+
+/* Interval -> recurring_cohort_t */
+static GHashTable *recurring_cohorts = NULL;
+
+/*
+ * Read-only actions (status, monitor, meta-data) are de-duplicated: one that
+ * is requested while an identical action is already queued or running is not
+ * executed, it follows the one in flight and receives a copy of its result.
+ * Optionally, status and monitor results are also reused for result_ttl ms.
+ */
+typedef struct action_result_s {
+    int     rc;
+    int     status;
+    char   *stdout_data;
+    char   *stderr_data;
+    gint64  expires;
+} action_result_t;
+
+/* Flight key -> leading action */
+static GHashTable *inflight_actions = NULL;
+/* Flight key -> action_result_t */
+static GHashTable *cached_results = NULL;
+static unsigned int result_ttl = 0;
+
+/**
+ * \internal
+ * \brief Build the id of an operation, as found in svc_action_t.id
+ *
+ * \return the id, to be freed with free(), or NULL on failure
+ */
+static char *
+action_id(const char *name, const char *action, int interval)
+{
+    char *id = NULL;
+
+    if (asprintf(&id, "%s_%s_%d", name, action, interval) == -1) {
+        return NULL;
+    }
+    return id;
+}
 
 svc_action_t *
 services_action_create(const char *name, const char *action, int interval,
@@ -94,7 +199,7 @@ svc_action_t *resources_action_create(
     op->standard = strdup(standard);
     op->agent = strdup(agent);
     op->sequence = ++operations;
-    if (asprintf(&op->id, "%s_%s_%d", name, action, interval) == -1) {
+    if ((op->id = action_id(name, action, interval)) == NULL) {
         goto return_error;
     }
 
@@ -195,6 +300,21 @@ services_action_free(svc_action_t *op)
     free(op->stdout_data);
     free(op->stderr_data);
 
+    free(op->opaque->flight_key);
+    g_list_free(op->opaque->followers);
+
+    if (op->opaque->output_partial[0]) {
+        g_string_free(op->opaque->output_partial[0], TRUE);
+    }
+    if (op->opaque->output_partial[1]) {
+        g_string_free(op->opaque->output_partial[1], TRUE);
+    }
+
+    g_free(op->opaque->envp);
+    if (op->opaque->env_strings) {
+        g_ptr_array_unref(op->opaque->env_strings);
+    }
+
     if (op->params) {
         g_hash_table_destroy(op->params);
         op->params = NULL;
@@ -203,23 +323,865 @@ services_action_free(svc_action_t *op)
     free(op);
 }
 
+static enum action_class
+action_get_class(svc_action_t *op)
+{
+    static const char *urgent[] = {
+        "start", "stop", "enable", "disable",
+        "promote", "demote", "migrate_to", "migrate_from"
+    };
+    unsigned int lpc;
+
+    if (op->action) {
+        for (lpc = 0; lpc < DIMOF(urgent); lpc++) {
+            if (strcmp(op->action, urgent[lpc]) == 0) {
+                return ACTION_CLASS_URGENT;
+            }
+        }
+    }
+
+    return op->interval > 0 ? ACTION_CLASS_RECURRING : ACTION_CLASS_NORMAL;
+}
+
+static gboolean
+action_can_run(svc_action_t *op)
+{
+    if (running_actions >= max_concurrent) {
+        return FALSE;
+    }
+
+    return op->rsc == NULL
+           || g_hash_table_lookup(active_resources, op->rsc) == NULL;
+}
+
+static void
+action_release(svc_action_t *op)
+{
+    if (!op->opaque->running) {
+        return;
+    }
+
+    op->opaque->running = FALSE;
+    op->opaque->run_ms = g_get_monotonic_time() / 1000 - op->opaque->started_at;
+    op->opaque->usage.wall_ms = op->opaque->run_ms;
+    running_actions--;
+
+    if (op->rsc && g_hash_table_lookup(active_resources, op->rsc) == op) {
+        g_hash_table_remove(active_resources, op->rsc);
+    }
+
+    if (dispatch_trigger) {
+        mainloop_set_trigger(dispatch_trigger);
+    }
+}
+
+static gboolean
+action_launch(svc_action_t *op)
+{
+    op->opaque->wait_ms = 0;
+
+    if (op->opaque->queued) {
+        guint64 waited = (g_get_monotonic_time() - op->opaque->queued_at) / 1000;
+
+        op->opaque->queued = FALSE;
+        op->opaque->wait_ms = waited;
+        total_wait_ms += waited;
+        if (waited > max_wait_ms) {
+            max_wait_ms = waited;
+        }
+    }
+
+    memset(&op->opaque->usage, 0, sizeof(op->opaque->usage));
+
+    dispatched_actions++;
+    running_actions++;
+    op->opaque->running = TRUE;
+    op->opaque->started_at = g_get_monotonic_time() / 1000;
+    if (op->rsc) {
+        g_hash_table_replace(active_resources, op->rsc, op);
+    }
+
+    if (services_os_action_execute(op, FALSE) == FALSE) {
+        action_release(op);
+        return FALSE;
+    }
+
+#ifdef WIN32
+    /* Execution is synchronous on Windows, so the action is already done */
+    action_release(op);
+#endif
+
+    return TRUE;
+}
+
+static gboolean
+action_dispatch_pending(gpointer user_data)
+{
+    int lpc;
+
+    for (lpc = 0; lpc < ACTION_CLASS_MAX; lpc++) {
+        GList *iter = pending_actions[lpc].head;
+
+        while (iter && running_actions < max_concurrent) {
+            GList *next = iter->next;
+            svc_action_t *op = iter->data;
+
+            if (action_can_run(op)) {
+                g_queue_delete_link(&pending_actions[lpc], iter);
+
+                if (action_launch(op) == FALSE) {
+                    /* The caller was already told the action was accepted,
+                     * so report the failure through the callback. */
+                    mh_err("Could not execute queued action %s",
+                           op->id ? op->id : op->opaque->exec);
+                    op->rc = OCF_UNKNOWN_ERROR;
+                    op->status = LRM_OP_ERROR;
+                    services_action_finalize(op);
+                }
+            }
+
+            iter = next;
+        }
+    }
+
+    return TRUE;
+}
+
+static gboolean
+action_unqueue(svc_action_t *op)
+{
+    int lpc;
+
+    for (lpc = 0; lpc < ACTION_CLASS_MAX; lpc++) {
+        if (g_queue_remove(&pending_actions[lpc], op)) {
+            op->opaque->queued = FALSE;
+            return TRUE;
+        }
+    }
+
+    return FALSE;
+}
+
+static svc_action_t *
+action_find_pending(const char *id)
+{
+    int lpc;
+    GList *iter;
+
+    for (lpc = 0; lpc < ACTION_CLASS_MAX; lpc++) {
+        for (iter = pending_actions[lpc].head; iter; iter = iter->next) {
+            svc_action_t *op = iter->data;
+
+            if (op->id && strcmp(op->id, id) == 0) {
+                return op;
+            }
+        }
+    }
+
+    return NULL;
+}
+
+static gint64
+recurring_next_due(recurring_cohort_t *cohort, svc_action_t *op, gint64 after)
+{
+    gint64 due;
+    gint64 phase = 0;
+
+    if (cohort->phases > 1 && op->rsc) {
+        phase = (g_str_hash(op->rsc) % cohort->phases)
+                * (cohort->interval / cohort->phases);
+    }
+
+    due = (after / cohort->interval) * cohort->interval + phase;
+    while (due <= after) {
+        due += cohort->interval;
+    }
+
+    return due;
+}
+
+static gboolean recurring_cohort_tick(gpointer data);
+
+static void
+recurring_cohort_arm(recurring_cohort_t *cohort)
+{
+    GList *iter;
+    gint64 next = -1;
+    gint64 now = g_get_monotonic_time() / 1000;
+
+    for (iter = cohort->actions; iter; iter = iter->next) {
+        svc_action_t *op = iter->data;
+
+        if (next < 0 || op->opaque->next_due < next) {
+            next = op->opaque->next_due;
+        }
+    }
+
+    if (cohort->timer) {
+        if (cohort->armed_for == next) {
+            return;
+        }
+        g_source_remove(cohort->timer);
+        cohort->timer = 0;
+    }
+
+    if (next >= 0) {
+        cohort->armed_for = next;
+        cohort->timer = g_timeout_add(next > now ? next - now : 0,
+                                      recurring_cohort_tick, cohort);
+    }
+}
+
+static gboolean
+recurring_cohort_tick(gpointer data)
+{
+    GList *iter;
+    recurring_cohort_t *cohort = data;
+    gint64 now = g_get_monotonic_time() / 1000;
+
+    cohort->timer = 0;
+
+    for (iter = cohort->actions; iter; iter = iter->next) {
+        svc_action_t *op = iter->data;
+
+        if (op->opaque->next_due > now) {
+            continue;
+        }
+
+        if (op->opaque->running || op->opaque->queued) {
+            mh_debug("Skipping %s, the previous invokation has not completed",
+                     op->id);
+
+        } else {
+            mh_debug("Scheduling another invokation of %s", op->id);
+
+            /* Clean out the old result */
+            free(op->stdout_data); op->stdout_data = NULL;
+            free(op->stderr_data); op->stderr_data = NULL;
+
+            if (services_action_async(op, NULL) == FALSE) {
+                mh_err("Could not execute %s, will retry in %dms",
+                       op->id, op->interval);
+            }
+        }
+
+        op->opaque->next_due = recurring_next_due(cohort, op, now);
+    }
+
+    recurring_cohort_arm(cohort);
+    return FALSE;
+}
+
+static void
+recurring_action_add(svc_action_t *op)
+{
+    recurring_cohort_t *cohort;
+
+    if (recurring_cohorts == NULL) {
+        recurring_cohorts = g_hash_table_new(g_direct_hash, g_direct_equal);
+    }
+
+    cohort = g_hash_table_lookup(recurring_cohorts,
+                                 GINT_TO_POINTER(op->interval));
+    if (cohort == NULL) {
+        cohort = g_new0(recurring_cohort_t, 1);
+        cohort->interval = op->interval;
+        cohort->phases = CLAMP(op->interval / 1000, 1, RECURRING_MAX_PHASES);
+        g_hash_table_insert(recurring_cohorts, GINT_TO_POINTER(op->interval),
+                            cohort);
+    }
+
+    /* Join at the first slot that leaves at least half an interval since
+     * the initial invokation was started. */
+    op->opaque->cohort = cohort;
+    op->opaque->next_due = recurring_next_due(cohort, op,
+            op->opaque->started_at + op->interval / 2);
+
+    cohort->actions = g_list_prepend(cohort->actions, op);
+    recurring_cohort_arm(cohort);
+}
+
+static void
+recurring_action_remove(svc_action_t *op)
+{
+    recurring_cohort_t *cohort = op->opaque->cohort;
+
+    if (cohort == NULL) {
+        return;
+    }
+
+    op->opaque->cohort = NULL;
+    cohort->actions = g_list_remove(cohort->actions, op);
+
+    if (cohort->actions == NULL) {
+        if (cohort->timer) {
+            g_source_remove(cohort->timer);
+        }
+        g_hash_table_remove(recurring_cohorts, GINT_TO_POINTER(cohort->interval));
+        g_free(cohort);
+    }
+}
+
+static gboolean
+action_is_one_of(svc_action_t *op, const char **actions, unsigned int count)
+{
+    unsigned int lpc;
+
+    for (lpc = 0; op->action && lpc < count; lpc++) {
+        if (strcmp(op->action, actions[lpc]) == 0) {
+            return TRUE;
+        }
+    }
+
+    return FALSE;
+}
+
+static char *
+action_flight_key(svc_action_t *op)
+{
+    static const char *read_only[] = { "status", "monitor", "meta-data" };
+    GString *key;
+
+    if (op->interval || op->standard == NULL || op->agent == NULL
+        || op->opaque->output_callback
+        || !action_is_one_of(op, read_only, DIMOF(read_only))) {
+        return NULL;
+    }
+
+    key = g_string_new(NULL);
+    g_string_append_printf(key, "%s:%s:%s:%s", op->standard,
+                           op->provider ? op->provider : "", op->agent,
+                           op->action);
+
+    /* OCF agents see the instance as OCF_RESOURCE_INSTANCE */
+    if (strcasecmp(op->standard, "ocf") == 0 && op->rsc) {
+        g_string_append_printf(key, ":%s", op->rsc);
+    }
+
+    if (op->params && g_hash_table_size(op->params)) {
+        GList *iter;
+        GList *keys = g_list_sort(g_hash_table_get_keys(op->params),
+                                  (GCompareFunc) strcmp);
+        GChecksum *sum = g_checksum_new(G_CHECKSUM_SHA1);
+
+        for (iter = keys; iter; iter = iter->next) {
+            const char *value = g_hash_table_lookup(op->params, iter->data);
+
+            g_checksum_update(sum, iter->data, strlen(iter->data) + 1);
+            g_checksum_update(sum, (const guchar *) value, strlen(value) + 1);
+        }
+
+        g_string_append_printf(key, ":%s", g_checksum_get_string(sum));
+        g_checksum_free(sum);
+        g_list_free(keys);
+    }
+
+    return g_string_free(key, FALSE);
+}
+
+static void
+action_result_free(gpointer data)
+{
+    action_result_t *result = data;
+
+    free(result->stdout_data);
+    free(result->stderr_data);
+    free(result);
+}
+
+static void
+action_set_result(svc_action_t *op, int rc, int status,
+                  const char *stdout_data, const char *stderr_data)
+{
+    op->rc = rc;
+    op->status = status;
+
+    free(op->stdout_data);
+    op->stdout_data = stdout_data ? strdup(stdout_data) : NULL;
+
+    free(op->stderr_data);
+    op->stderr_data = stderr_data ? strdup(stderr_data) : NULL;
+}
+
+/**
+ * \internal
+ * \brief Add the result of a completed action to its resource's history
+ */
+static void
+history_record(svc_action_t *op)
+{
+    history_ring_t *ring = NULL;
+    services_history_t *record = NULL;
+
+    if (op->rsc == NULL) {
+        return;
+    }
+
+    if (resource_history == NULL) {
+        resource_history = g_hash_table_new_full(g_str_hash, g_str_equal,
+                                                 free, g_free);
+    }
+
+    ring = g_hash_table_lookup(resource_history, op->rsc);
+    if (ring == NULL) {
+        ring = g_new0(history_ring_t, 1);
+        g_hash_table_insert(resource_history, strdup(op->rsc), ring);
+    }
+
+    record = &ring->records[ring->next];
+    memset(record, 0, sizeof(*record));
+
+    record->timestamp = g_get_real_time() / G_USEC_PER_SEC;
+    record->duration_ms = op->opaque->usage.wall_ms;
+    record->interval = op->interval;
+    record->rc = op->rc;
+    record->status = op->status;
+    if (op->action) {
+        g_strlcpy(record->action, op->action, sizeof(record->action));
+    }
+
+    if (op->stderr_data) {
+        const char *tail = op->stderr_data;
+        size_t len = strlen(tail);
+
+        if (len >= sizeof(record->stderr_tail)) {
+            tail += len - (sizeof(record->stderr_tail) - 1);
+            /* Do not start in the middle of a UTF-8 sequence */
+            while ((*tail & 0xC0) == 0x80) {
+                tail++;
+            }
+        }
+        g_strlcpy(record->stderr_tail, tail, sizeof(record->stderr_tail));
+    }
+
+    ring->next = (ring->next + 1) % SERVICES_HISTORY_LENGTH;
+    if (ring->count < SERVICES_HISTORY_LENGTH) {
+        ring->count++;
+    }
+}
+
+static void
+action_complete_follower(svc_action_t *op)
+{
+    op->pid = 0;
+    memset(&op->opaque->usage, 0, sizeof(op->opaque->usage));
+    history_record(op);
+
+    if (op->opaque->callback) {
+        op->opaque->callback(op);
+    }
+
+    services_action_free(op);
+}
+
+static gboolean
+action_complete_cached(gpointer data)
+{
+    action_complete_follower((svc_action_t *) data);
+    return FALSE;
+}
+
+/**
+ * \internal
+ * \brief Stop an action from being the leader for identical actions
+ *
+ * If the action completed, its result is cached when required.  Otherwise
+ * the followers are resubmitted, and the first of them takes over as leader.
+ *
+ * \return the followers that should receive this action's result
+ */
+static GList *
+action_flight_land(svc_action_t *op, gboolean completed)
+{
+    static const char *cacheable[] = { "status", "monitor" };
+    GList *followers = op->opaque->followers;
+    GList *iter;
+
+    if (op->opaque->flight_key == NULL) {
+        return NULL;
+    }
+
+    if (g_hash_table_lookup(inflight_actions, op->opaque->flight_key) == op) {
+        g_hash_table_remove(inflight_actions, op->opaque->flight_key);
+    }
+
+    if (completed && result_ttl && op->status == LRM_OP_DONE
+        && action_is_one_of(op, cacheable, DIMOF(cacheable))) {
+        action_result_t *result = calloc(1, sizeof(action_result_t));
+
+        result->rc = op->rc;
+        result->status = op->status;
+        result->stdout_data = op->stdout_data ? strdup(op->stdout_data) : NULL;
+        result->stderr_data = op->stderr_data ? strdup(op->stderr_data) : NULL;
+        result->expires = g_get_monotonic_time() / 1000 + result_ttl;
+
+        g_hash_table_replace(cached_results, op->opaque->flight_key, result);
+
+    } else {
+        free(op->opaque->flight_key);
+    }
+
+    op->opaque->flight_key = NULL;
+    op->opaque->followers = NULL;
+
+    if (completed) {
+        return followers;
+    }
+
+    for (iter = followers; iter; iter = iter->next) {
+        svc_action_t *follower = iter->data;
+
+        if (services_action_async(follower, NULL) == FALSE) {
+            action_set_result(follower, OCF_UNKNOWN_ERROR, LRM_OP_ERROR,
+                              NULL, NULL);
+            g_idle_add(action_complete_cached, follower);
+        }
+    }
+    g_list_free(followers);
+
+    return NULL;
+}
+
+/**
+ * \internal
+ * \brief Attach an action to an identical one if possible
+ *
+ * \retval TRUE the action will be completed with a shared result
+ * \retval FALSE the action must be executed
+ */
+static gboolean
+action_flight_join(svc_action_t *op)
+{
+    char *key = NULL;
+    svc_action_t *leader = NULL;
+    action_result_t *result = NULL;
+
+    if ((key = action_flight_key(op)) == NULL) {
+        return FALSE;
+    }
+
+    if (inflight_actions == NULL) {
+        inflight_actions = g_hash_table_new(g_str_hash, g_str_equal);
+        cached_results = g_hash_table_new_full(g_str_hash, g_str_equal,
+                                               free, action_result_free);
+    }
+
+    result = g_hash_table_lookup(cached_results, key);
+    if (result && result->expires <= g_get_monotonic_time() / 1000) {
+        g_hash_table_remove(cached_results, key);
+        result = NULL;
+    }
+
+    if (result) {
+        mh_trace("Reusing cached result for %s", op->id);
+        action_set_result(op, result->rc, result->status,
+                          result->stdout_data, result->stderr_data);
+        g_idle_add(action_complete_cached, op);
+        free(key);
+        return TRUE;
+    }
+
+    if ((leader = g_hash_table_lookup(inflight_actions, key))) {
+        mh_trace("Attaching %s to in-flight %s", op->id, leader->id);
+        leader->opaque->followers = g_list_append(leader->opaque->followers,
+                                                  op);
+        free(key);
+        return TRUE;
+    }
+
+    op->opaque->flight_key = key;
+    g_hash_table_insert(inflight_actions, key, op);
+    return FALSE;
+}
+
+static void
+recurring_unregister(svc_action_t *op)
+{
+    GHashTable *actions = NULL;
+
+    if (recurring_actions == NULL
+        || g_hash_table_lookup(recurring_actions, op->id) != op) {
+        return;
+    }
+
+    g_hash_table_remove(recurring_actions, op->id);
+
+    actions = g_hash_table_lookup(recurring_by_resource, op->rsc);
+    if (actions) {
+        g_hash_table_remove(actions, op->id);
+        if (g_hash_table_size(actions) == 0) {
+            g_hash_table_remove(recurring_by_resource, op->rsc);
+        }
+    }
+}
+
+static gboolean
+action_cancel(svc_action_t *op)
+{
+    mh_debug("Removing %s", op->id);
+    recurring_action_remove(op);
+    recurring_unregister(op);
+
+    if (op->opaque->running) {
+        /* Still executing, it will be freed once it completes */
+        op->opaque->cancelled = TRUE;
+        return TRUE;
+    }
+
+    action_unqueue(op);
+
+    if (op->interval == 0) {
+        /* Somebody is waiting for the result of a one-shot action, so
+         * complete it rather than dropping it.  Its followers share the
+         * cancelled result. */
+        op->rc = OCF_UNKNOWN_ERROR;
+        op->status = LRM_OP_CANCELLED;
+        services_action_finalize(op);
+        return TRUE;
+    }
+
+    action_flight_land(op, FALSE);
+    services_action_free(op);
+
+    return TRUE;
+}
+
+static void
+recurring_register(svc_action_t *op)
+{
+    GHashTable *actions = NULL;
+    svc_action_t *existing = NULL;
+
+    if (recurring_actions == NULL) {
+        recurring_actions = g_hash_table_new(g_str_hash, g_str_equal);
+        recurring_by_resource = g_hash_table_new_full(g_str_hash,
+                g_str_equal, free, (GDestroyNotify) g_hash_table_destroy);
+    }
+
+    existing = g_hash_table_lookup(recurring_actions, op->id);
+    if (existing == op) {
+        return;
+
+    } else if (existing) {
+        /* A new definition of the same operation replaces the old one */
+        action_cancel(existing);
+    }
+
+    g_hash_table_insert(recurring_actions, op->id, op);
+
+    actions = g_hash_table_lookup(recurring_by_resource, op->rsc);
+    if (actions == NULL) {
+        actions = g_hash_table_new(g_str_hash, g_str_equal);
+        g_hash_table_insert(recurring_by_resource, strdup(op->rsc), actions);
+    }
+    g_hash_table_insert(actions, op->id, op);
+}
+
 gboolean
 services_action_cancel(const char *name, const char *action, int interval)
 {
     svc_action_t* op = NULL;
-    char id[512];
+    char *id = action_id(name, action, interval);
 
-    snprintf(id, sizeof(id), "%s_%s_%d", name, action, interval);
+    if (id == NULL) {
+        return FALSE;
+    }
 
-    if (!(op = g_hash_table_lookup(recurring_actions, id))) {
+    if (recurring_actions) {
+        op = g_hash_table_lookup(recurring_actions, id);
+    }
+    if (op == NULL) {
+        op = action_find_pending(id);
+    }
+    free(id);
+
+    if (op == NULL) {
         return FALSE;
     }
 
-    mh_debug("Removing %s", op->id);
-    if (op->opaque->repeat_timer) {
-        g_source_remove(op->opaque->repeat_timer);
+    return action_cancel(op);
+}
+
+unsigned int
+services_action_cancel_all(const char *name)
+{
+    GHashTable *actions = NULL;
+    GList *ops = NULL;
+    GList *iter = NULL;
+    unsigned int count = 0;
+
+    if (recurring_by_resource == NULL
+        || (actions = g_hash_table_lookup(recurring_by_resource, name)) == NULL) {
+        return 0;
+    }
+
+    /* Cancelling modifies the index, so work from a copy */
+    ops = g_hash_table_get_values(actions);
+    for (iter = ops; iter; iter = iter->next) {
+        if (action_cancel(iter->data)) {
+            count++;
+        }
+    }
+    g_list_free(ops);
+
+    return count;
+}
+
+GList *
+services_action_list_recurring(void)
+{
+    if (recurring_actions == NULL) {
+        return NULL;
+    }
+    return g_hash_table_get_values(recurring_actions);
+}
+
+static void
+agent_usage_free(gpointer data)
+{
+    services_agent_usage_t *usage = data;
+
+    free(usage->agent);
+    free(usage);
+}
+
+/**
+ * \internal
+ * \brief Add what an executed action consumed to its agent's totals
+ */
+static void
+action_account(svc_action_t *op)
+{
+    services_usage_t *usage = &op->opaque->usage;
+    services_agent_usage_t *totals = NULL;
+    char *key = NULL;
+
+    if (op->standard == NULL || op->agent == NULL) {
+        return;
+    }
+
+    if (agent_usage == NULL) {
+        agent_usage = g_hash_table_new_full(g_str_hash, g_str_equal, NULL,
+                                            agent_usage_free);
+    }
+
+    if (op->provider) {
+        key = g_strdup_printf("%s:%s:%s", op->standard, op->provider,
+                              op->agent);
+    } else {
+        key = g_strdup_printf("%s:%s", op->standard, op->agent);
+    }
+
+    totals = g_hash_table_lookup(agent_usage, key);
+    if (totals == NULL) {
+        totals = calloc(1, sizeof(services_agent_usage_t));
+        totals->agent = strdup(key);
+        g_hash_table_insert(agent_usage, totals->agent, totals);
+    }
+    g_free(key);
+
+    totals->actions++;
+    totals->wall_ms += usage->wall_ms;
+    totals->user_ms += usage->user_ms;
+    totals->system_ms += usage->system_ms;
+    totals->read_bytes += usage->read_bytes;
+    totals->write_bytes += usage->write_bytes;
+    totals->max_rss_kb = MAX(totals->max_rss_kb, usage->max_rss_kb);
+
+    mh_trace("%s used %ums (%ums user, %ums system), %" G_GUINT64_FORMAT "KiB",
+             op->id, usage->wall_ms, usage->user_ms, usage->system_ms,
+             usage->max_rss_kb);
+}
+
+void
+services_action_finalize(svc_action_t *op)
+{
+    int recurring = 0;
+    GList *followers = NULL;
+    GList *iter = NULL;
+
+    if (op->opaque->running) {
+        action_release(op);
+        action_account(op);
+    }
+
+    if (op->opaque->cancelled) {
+        mh_debug("Discarding result of cancelled action %s", op->id);
+        action_flight_land(op, FALSE);
+        services_action_free(op);
+        return;
+    }
+
+    followers = action_flight_land(op, TRUE);
+    services_metadata_store(op);
+    history_record(op);
+
+    if (op->interval) {
+        recurring = 1;
+        if (op->opaque->cohort == NULL) {
+            recurring_action_add(op);
+        }
+    }
+
+    op->pid = 0;
+
+    if (op->opaque->callback) {
+        op->opaque->callback(op);
+    }
+
+    for (iter = followers; iter; iter = iter->next) {
+        svc_action_t *follower = iter->data;
+
+        action_set_result(follower, op->rc, op->status,
+                          op->stdout_data, op->stderr_data);
+        action_complete_follower(follower);
+    }
+    g_list_free(followers);
+
+    if (!recurring) {
+        /*
+         * If this is a recurring action, do not free explicitly.
+         * It will get freed whenever the action gets cancelled.
+         */
+        services_action_free(op);
+    }
+}
+
+static gboolean
+action_schedule(svc_action_t *op)
+{
+    enum action_class class;
+    unsigned int ahead = 0;
+    int lpc;
+
+    if (active_resources == NULL) {
+        active_resources = g_hash_table_new(g_str_hash, g_str_equal);
+        dispatch_trigger = mainloop_add_trigger(G_PRIORITY_HIGH,
+                                                action_dispatch_pending,
+                                                NULL);
     }
-    services_action_free(op);
+
+    class = action_get_class(op);
+
+    /* Anything queued at the same or a higher priority goes first */
+    for (lpc = 0; lpc <= class; lpc++) {
+        ahead += g_queue_get_length(&pending_actions[lpc]);
+    }
+
+    if (ahead == 0 && action_can_run(op)) {
+        return action_launch(op);
+    }
+
+    mh_trace("Queueing %s behind %u other action(s)",
+             op->id ? op->id : op->opaque->exec, ahead);
+
+    op->opaque->queued = TRUE;
+    op->opaque->queued_at = g_get_monotonic_time();
+    g_queue_push_tail(&pending_actions[class], op);
+
+    /* The actions ahead may be waiting on their resource rather than for
+     * a slot, in which case this one can start straight away */
+    mainloop_set_trigger(dispatch_trigger);
 
     return TRUE;
 }
@@ -227,26 +1189,212 @@ services_action_cancel(const char *name, const char *action, int interval)
 gboolean
 services_action_async(svc_action_t* op, void (*action_callback)(svc_action_t *))
 {
+    char *xml = NULL;
+
     if (action_callback) {
         op->opaque->callback = action_callback;
     }
 
-    if (recurring_actions == NULL) {
-        recurring_actions = g_hash_table_new_full(g_str_hash, g_str_equal,
-                                                  NULL, NULL);
+    if (op->interval > 0) {
+        recurring_register(op);
     }
 
-    if (op->interval > 0) {
-        g_hash_table_replace(recurring_actions, op->id, op);
+    if ((xml = services_metadata_lookup(op))) {
+        action_set_result(op, OCF_OK, LRM_OP_DONE, NULL, NULL);
+        op->stdout_data = xml;
+        g_idle_add(action_complete_cached, op);
+        return TRUE;
+    }
+
+    if (action_flight_join(op)) {
+        return TRUE;
+    }
+
+    if (action_schedule(op) == FALSE) {
+        action_flight_land(op, FALSE);
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+void
+services_action_stream_output(svc_action_t *op,
+                              void (*output_callback)(svc_action_t *op,
+                                                      gboolean is_stderr,
+                                                      const char *data,
+                                                      size_t len),
+                              size_t tail)
+{
+    op->opaque->output_callback = output_callback;
+    op->opaque->output_tail = tail ? tail : SERVICES_DEFAULT_OUTPUT_TAIL;
+}
+
+void
+services_action_get_timing(svc_action_t *op, unsigned int *wait_ms,
+                           unsigned int *run_ms)
+{
+    if (wait_ms) {
+        *wait_ms = op->opaque->wait_ms;
+    }
+    if (run_ms) {
+        *run_ms = op->opaque->run_ms;
+    }
+}
+
+void
+services_action_get_usage(svc_action_t *op, services_usage_t *usage)
+{
+    *usage = op->opaque->usage;
+}
+
+static gint
+agent_usage_compare(gconstpointer a, gconstpointer b)
+{
+    const services_agent_usage_t *usage_a = a;
+    const services_agent_usage_t *usage_b = b;
+    guint64 cpu_a = usage_a->user_ms + usage_a->system_ms;
+    guint64 cpu_b = usage_b->user_ms + usage_b->system_ms;
+
+    if (cpu_a != cpu_b) {
+        return cpu_a > cpu_b ? -1 : 1;
+    }
+    return strcmp(usage_a->agent, usage_b->agent);
+}
+
+GList *
+services_get_agent_usage(void)
+{
+    GList *usage = NULL;
+    GHashTableIter iter;
+    gpointer value;
+
+    if (agent_usage == NULL) {
+        return NULL;
     }
 
-    return services_os_action_execute(op, FALSE);
+    g_hash_table_iter_init(&iter, agent_usage);
+    while (g_hash_table_iter_next(&iter, NULL, &value)) {
+        services_agent_usage_t *copy = malloc(sizeof(services_agent_usage_t));
+
+        *copy = *(services_agent_usage_t *) value;
+        copy->agent = strdup(copy->agent);
+        usage = g_list_prepend(usage, copy);
+    }
+
+    return g_list_sort(usage, agent_usage_compare);
+}
+
+void
+services_agent_usage_free(GList *usage)
+{
+    g_list_free_full(usage, agent_usage_free);
+}
+
+unsigned int
+services_get_history(const char *name, services_history_t *records,
+                     unsigned int max)
+{
+    history_ring_t *ring = NULL;
+    unsigned int lpc;
+
+    if (resource_history == NULL || name == NULL) {
+        return 0;
+    }
+
+    ring = g_hash_table_lookup(resource_history, name);
+    if (ring == NULL) {
+        return 0;
+    }
+
+    max = MIN(max, ring->count);
+    for (lpc = 0; lpc < max; lpc++) {
+        unsigned int index = (ring->next + SERVICES_HISTORY_LENGTH - 1 - lpc)
+                             % SERVICES_HISTORY_LENGTH;
+
+        records[lpc] = ring->records[index];
+    }
+
+    return max;
+}
+
+void
+services_set_result_ttl(unsigned int ttl)
+{
+    result_ttl = ttl;
+
+    if (ttl == 0 && cached_results) {
+        g_hash_table_remove_all(cached_results);
+    }
+}
+
+void
+services_set_lsb_pidfile_status(gboolean enabled)
+{
+    lsb_pidfile_status = enabled;
+}
+
+gboolean
+services_lsb_pidfile_status(void)
+{
+    return lsb_pidfile_status;
+}
+
+void
+services_set_max_concurrent(unsigned int max)
+{
+    max_concurrent = max ? max : SERVICES_DEFAULT_MAX_CONCURRENT;
+
+    if (dispatch_trigger) {
+        mainloop_set_trigger(dispatch_trigger);
+    }
+}
+
+void
+services_get_stats(services_stats_t *stats)
+{
+    int lpc;
+
+    memset(stats, 0, sizeof(*stats));
+
+    for (lpc = 0; lpc < ACTION_CLASS_MAX; lpc++) {
+        stats->queued += g_queue_get_length(&pending_actions[lpc]);
+    }
+
+    stats->running = running_actions;
+    stats->max_concurrent = max_concurrent;
+    stats->dispatched = dispatched_actions;
+    if (dispatched_actions) {
+        stats->wait_avg = total_wait_ms / dispatched_actions;
+    }
+    stats->wait_max = max_wait_ms;
 }
 
 gboolean
 services_action_sync(svc_action_t* op)
 {
-    gboolean rc = services_os_action_execute(op, TRUE);
+    gboolean rc = TRUE;
+    gint64 started = 0;
+    char *xml = services_metadata_lookup(op);
+
+    memset(&op->opaque->usage, 0, sizeof(op->opaque->usage));
+
+    if (xml) {
+        action_set_result(op, OCF_OK, LRM_OP_DONE, NULL, NULL);
+        op->stdout_data = xml;
+        history_record(op);
+        return TRUE;
+    }
+
+    started = g_get_monotonic_time();
+
+    rc = services_os_action_execute(op, TRUE);
+    if (rc) {
+        op->opaque->usage.wall_ms = (g_get_monotonic_time() - started) / 1000;
+        action_account(op);
+        services_metadata_store(op);
+        history_record(op);
+    }
     mh_trace(" > %s_%s_%d: %s = %d", op->rsc, op->action, op->interval,
              op->opaque->exec, op->rc);
     if (op->stdout_data) {
@@ -270,6 +1418,20 @@ services_list(void)
     return resources_list_agents("lsb", NULL);
 }
 
+pid_t
+services_watch(const char *name,
+               void (*callback)(const char *name, pid_t pid, void *user_data),
+               void *user_data)
+{
+    return services_os_watch(name, callback, user_data);
+}
+
+gboolean
+services_unwatch(const char *name)
+{
+    return services_os_unwatch(name);
+}
+
 GList *
 resources_list_standards(void)
 {
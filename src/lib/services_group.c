@@ -0,0 +1,440 @@
+/*
+ * Copyright (C) 2012 Red Hat, Inc.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+/**
+ * \file
+ * \brief Groups of actions executed in dependency order
+ *
+ * The ordering constraints of a group form a DAG.  Each member counts the
+ * members it still waits for and is submitted to services_action_async()
+ * when that count drops to zero, so independent branches run in parallel
+ * up to the group's limit, and beyond that the library's own scheduler
+ * still applies.
+ */
+
+#include "config.h"
+
+#include <string.h>
+
+#include "matahari/logging.h"
+#include "matahari/services.h"
+
+typedef struct group_member_s {
+    services_group_result_t result;
+    services_group_t *group;
+
+    /* Until submitted, then owned by the services library */
+    svc_action_t *op;
+    /* Names given to services_group_add() */
+    GList *after;
+
+    /* Members that must succeed first, and those waiting for this one */
+    GList *waits_for;
+    GList *dependents;
+    unsigned int pending;
+
+    gboolean done;
+    gint64 submitted;
+
+    /* Longest chain of members ending with this one */
+    unsigned int path_ms;
+    struct group_member_s *path_previous;
+} group_member_t;
+
+struct services_group_s {
+    /* group_member_t *, in the order they were added */
+    GPtrArray *members;
+    /* Name -> group_member_t */
+    GHashTable *by_name;
+
+    gboolean reverse;
+    unsigned int max_concurrent;
+
+    GQueue ready;
+    unsigned int running;
+    unsigned int remaining;
+    gboolean finished;
+
+    gint64 started;
+    unsigned int elapsed_ms;
+
+    void (*callback)(services_group_t *group, void *user_data);
+    void *user_data;
+};
+
+static void
+group_member_free(gpointer data)
+{
+    group_member_t *member = data;
+
+    if (member->op) {
+        services_action_free(member->op);
+    }
+    g_list_free_full(member->after, free);
+    g_list_free(member->waits_for);
+    g_list_free(member->dependents);
+    free(member->result.name);
+    free(member);
+}
+
+services_group_t *
+services_group_new(gboolean reverse, unsigned int max_concurrent)
+{
+    services_group_t *group = calloc(1, sizeof(services_group_t));
+
+    group->members = g_ptr_array_new_with_free_func(group_member_free);
+    group->by_name = g_hash_table_new(g_str_hash, g_str_equal);
+    group->reverse = reverse;
+    group->max_concurrent = max_concurrent;
+    g_queue_init(&group->ready);
+
+    return group;
+}
+
+gboolean
+services_group_add(services_group_t *group, svc_action_t *op, GList *after)
+{
+    group_member_t *member = NULL;
+    GList *iter = NULL;
+
+    if (op->rsc == NULL || g_hash_table_lookup(group->by_name, op->rsc)) {
+        mh_err("Group already has a member called %s", op->rsc);
+        services_action_free(op);
+        return FALSE;
+    }
+
+    member = calloc(1, sizeof(group_member_t));
+    member->group = group;
+    member->op = op;
+    member->result.name = strdup(op->rsc);
+
+    for (iter = after; iter != NULL; iter = iter->next) {
+        member->after = g_list_prepend(member->after, strdup(iter->data));
+    }
+
+    g_ptr_array_add(group->members, member);
+    g_hash_table_insert(group->by_name, member->result.name, member);
+    return TRUE;
+}
+
+/**
+ * \internal
+ * \brief Turn the names given to services_group_add() into edges
+ */
+static gboolean
+group_link(services_group_t *group)
+{
+    unsigned int lpc;
+
+    for (lpc = 0; lpc < group->members->len; lpc++) {
+        group_member_t *member = g_ptr_array_index(group->members, lpc);
+        GList *iter = NULL;
+
+        for (iter = member->after; iter != NULL; iter = iter->next) {
+            group_member_t *first = g_hash_table_lookup(group->by_name,
+                                                        iter->data);
+            group_member_t *second = member;
+
+            if (first == NULL) {
+                mh_err("%s must come after %s, which is not in the group",
+                       member->result.name, (char *) iter->data);
+                return FALSE;
+            }
+
+            if (group->reverse) {
+                second = first;
+                first = member;
+            }
+
+            second->waits_for = g_list_prepend(second->waits_for, first);
+            second->pending++;
+            first->dependents = g_list_prepend(first->dependents, second);
+        }
+    }
+
+    return TRUE;
+}
+
+/**
+ * \internal
+ * \brief Check that the ordering constraints do not form a cycle
+ */
+static gboolean
+group_is_acyclic(services_group_t *group)
+{
+    unsigned int *pending = g_new(unsigned int, group->members->len);
+    GHashTable *index = g_hash_table_new(g_direct_hash, g_direct_equal);
+    GQueue ready = G_QUEUE_INIT;
+    unsigned int visited = 0;
+    unsigned int lpc;
+
+    for (lpc = 0; lpc < group->members->len; lpc++) {
+        group_member_t *member = g_ptr_array_index(group->members, lpc);
+
+        pending[lpc] = member->pending;
+        g_hash_table_insert(index, member, GUINT_TO_POINTER(lpc));
+        if (member->pending == 0) {
+            g_queue_push_tail(&ready, member);
+        }
+    }
+
+    while (!g_queue_is_empty(&ready)) {
+        group_member_t *member = g_queue_pop_head(&ready);
+        GList *iter = NULL;
+
+        visited++;
+        for (iter = member->dependents; iter != NULL; iter = iter->next) {
+            lpc = GPOINTER_TO_UINT(g_hash_table_lookup(index, iter->data));
+            if (--pending[lpc] == 0) {
+                g_queue_push_tail(&ready, iter->data);
+            }
+        }
+    }
+
+    g_hash_table_destroy(index);
+    g_free(pending);
+    return visited == group->members->len;
+}
+
+/**
+ * \internal
+ * \brief Skip a member and, transitively, everything that depends on it
+ */
+static void
+group_member_skip(group_member_t *member)
+{
+    GList *iter = NULL;
+
+    if (member->done) {
+        return;
+    }
+
+    mh_info("Skipping %s: a service it depends on failed",
+            member->result.name);
+
+    member->done = TRUE;
+    member->result.skipped = TRUE;
+    member->result.rc = OCF_UNKNOWN_ERROR;
+    member->result.status = LRM_OP_CANCELLED;
+    member->group->remaining--;
+
+    services_action_free(member->op);
+    member->op = NULL;
+
+    for (iter = member->dependents; iter != NULL; iter = iter->next) {
+        group_member_skip(iter->data);
+    }
+}
+
+/**
+ * \internal
+ * \brief Record a member's result and release or skip its dependents
+ */
+static void
+group_member_finish(group_member_t *member, int rc, int status)
+{
+    services_group_t *group = member->group;
+    gboolean succeeded = (status == LRM_OP_DONE && rc == OCF_OK);
+    GList *iter = NULL;
+
+    member->done = TRUE;
+    member->result.rc = rc;
+    member->result.status = status;
+    member->result.run_ms = (g_get_monotonic_time() - member->submitted) / 1000;
+    group->remaining--;
+
+    for (iter = member->waits_for; iter != NULL; iter = iter->next) {
+        group_member_t *first = iter->data;
+
+        if (member->path_previous == NULL
+            || first->path_ms > member->path_previous->path_ms) {
+            member->path_previous = first;
+        }
+    }
+    member->path_ms = member->result.run_ms;
+    if (member->path_previous) {
+        member->path_ms += member->path_previous->path_ms;
+    }
+
+    mh_debug("Group member %s completed with rc=%d after %ums",
+             member->result.name, rc, member->result.run_ms);
+
+    for (iter = member->dependents; iter != NULL; iter = iter->next) {
+        group_member_t *dependent = iter->data;
+
+        if (!succeeded) {
+            group_member_skip(dependent);
+
+        } else if (--dependent->pending == 0) {
+            g_queue_push_tail(&group->ready, dependent);
+        }
+    }
+}
+
+static void group_dispatch(services_group_t *group);
+
+static void
+group_member_done(svc_action_t *op)
+{
+    group_member_t *member = op->cb_data;
+
+    /* The action is freed by the services library once this returns */
+    op->cb_data = NULL;
+    member->op = NULL;
+    member->group->running--;
+
+    group_member_finish(member, op->rc, op->status);
+    group_dispatch(member->group);
+}
+
+/**
+ * \internal
+ * \brief Submit ready members, and complete the group once all are done
+ */
+static void
+group_dispatch(services_group_t *group)
+{
+    while (!g_queue_is_empty(&group->ready)
+           && (group->max_concurrent == 0
+               || group->running < group->max_concurrent)) {
+        group_member_t *member = g_queue_pop_head(&group->ready);
+        gint64 now = g_get_monotonic_time();
+
+        if (member->done) {
+            continue;
+        }
+
+        member->submitted = now;
+        member->result.start_ms = (now - group->started) / 1000;
+        member->op->cb_data = member;
+
+        group->running++;
+        if (services_action_async(member->op, group_member_done) == FALSE) {
+            mh_err("Could not execute %s", member->result.name);
+            group->running--;
+            services_action_free(member->op);
+            member->op = NULL;
+            group_member_finish(member, OCF_UNKNOWN_ERROR, LRM_OP_ERROR);
+        }
+    }
+
+    if (group->remaining == 0 && !group->finished) {
+        group->finished = TRUE;
+        group->elapsed_ms = (g_get_monotonic_time() - group->started) / 1000;
+        /* The callback may free the group */
+        group->callback(group, group->user_data);
+    }
+}
+
+static gboolean
+group_start(gpointer data)
+{
+    group_dispatch((services_group_t *) data);
+    return FALSE;
+}
+
+gboolean
+services_group_run(services_group_t *group,
+                   void (*callback)(services_group_t *group, void *user_data),
+                   void *user_data)
+{
+    unsigned int lpc;
+
+    if (!group_link(group)) {
+        return FALSE;
+    }
+
+    if (!group_is_acyclic(group)) {
+        mh_err("The ordering constraints of the group form a cycle");
+        return FALSE;
+    }
+
+    group->callback = callback;
+    group->user_data = user_data;
+    group->remaining = group->members->len;
+    group->started = g_get_monotonic_time();
+
+    for (lpc = 0; lpc < group->members->len; lpc++) {
+        group_member_t *member = g_ptr_array_index(group->members, lpc);
+
+        if (member->pending == 0) {
+            g_queue_push_tail(&group->ready, member);
+        }
+    }
+
+    /* Always complete from the mainloop, even if nothing can be executed */
+    g_idle_add(group_start, group);
+    return TRUE;
+}
+
+GList *
+services_group_results(services_group_t *group)
+{
+    GList *results = NULL;
+    unsigned int lpc = group->members->len;
+
+    while (lpc-- > 0) {
+        group_member_t *member = g_ptr_array_index(group->members, lpc);
+
+        results = g_list_prepend(results, &member->result);
+    }
+    return results;
+}
+
+void
+services_group_timing(services_group_t *group, unsigned int *elapsed_ms,
+                      unsigned int *critical_ms, GList **critical_path)
+{
+    group_member_t *last = NULL;
+    unsigned int lpc;
+
+    for (lpc = 0; lpc < group->members->len; lpc++) {
+        group_member_t *member = g_ptr_array_index(group->members, lpc);
+
+        if (!member->result.skipped
+            && (last == NULL || member->path_ms > last->path_ms)) {
+            last = member;
+        }
+    }
+
+    if (elapsed_ms) {
+        *elapsed_ms = group->elapsed_ms;
+    }
+    if (critical_ms) {
+        *critical_ms = last ? last->path_ms : 0;
+    }
+    if (critical_path) {
+        *critical_path = NULL;
+        for (; last != NULL; last = last->path_previous) {
+            *critical_path = g_list_prepend(*critical_path, last->result.name);
+        }
+    }
+}
+
+void
+services_group_free(services_group_t *group)
+{
+    if (group == NULL) {
+        return;
+    }
+
+    g_queue_clear(&group->ready);
+    g_hash_table_destroy(group->by_name);
+    g_ptr_array_free(group->members, TRUE);
+    free(group);
+}
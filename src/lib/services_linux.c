@@ -21,11 +21,27 @@
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <sys/wait.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <poll.h>
 #include <errno.h>
 #include <unistd.h>
 #include <dirent.h>
 #include <fcntl.h>
 #include <string.h>
+#include <signal.h>
+
+#ifdef HAVE_POSIX_SPAWNP
+#include <spawn.h>
+#endif
+
+#ifdef HAVE_SYS_INOTIFY_H
+#include <sys/inotify.h>
+#endif
+
+#ifdef HAVE_MEMFD_CREATE
+#include <sys/mman.h>
+#endif
 
 #include "matahari/logging.h"
 #include "matahari/mainloop.h"
@@ -34,6 +50,12 @@
 #include "services_private.h"
 #include "sigar.h"
 
+#if defined(HAVE_POSIX_SPAWNP) && defined(HAVE_POSIX_SPAWN_FILE_ACTIONS_ADDCLOSEFROM_NP)
+#  define USE_POSIX_SPAWN 1
+#endif
+
+extern char **environ;
+
 static inline void
 set_fd_opts(int fd, int opts)
 {
@@ -47,6 +69,69 @@ set_fd_opts(int fd, int opts)
     }
 }
 
+/* Longest line passed to an output callback in one piece */
+#define OUTPUT_LINE_MAX 4096
+
+static void
+stream_flush(svc_action_t *op, gboolean is_err)
+{
+    GString *partial = op->opaque->output_partial[is_err];
+
+    if (partial && partial->len) {
+        op->opaque->output_callback(op, is_err, partial->str, partial->len);
+        g_string_truncate(partial, 0);
+    }
+}
+
+/**
+ * \internal
+ * \brief Pass complete lines of output to a streaming action's callback
+ */
+static void
+stream_output(svc_action_t *op, gboolean is_err, const char *buf, size_t len)
+{
+    GString *partial = op->opaque->output_partial[is_err];
+    size_t complete = len;
+
+    if (partial == NULL) {
+        partial = op->opaque->output_partial[is_err] = g_string_new(NULL);
+    }
+
+    while (complete > 0 && buf[complete - 1] != '\n') {
+        complete--;
+    }
+
+    g_string_append_len(partial, buf, complete);
+    if (complete) {
+        stream_flush(op, is_err);
+    }
+
+    g_string_append_len(partial, buf + complete, len - complete);
+    if (partial->len >= OUTPUT_LINE_MAX) {
+        stream_flush(op, is_err);
+    }
+}
+
+/**
+ * \internal
+ * \brief Only keep the last op->opaque->output_tail bytes of output
+ */
+static char *
+trim_output(svc_action_t *op, char *data, int *len)
+{
+    size_t tail = op->opaque->output_tail;
+    const char *start;
+
+    if (data == NULL || (size_t) *len <= tail) {
+        return data;
+    }
+
+    start = data + *len - tail;
+    *len = tail;
+    memmove(data, start, tail + 1);
+    return realloc(data, tail + 1);
+}
+
 static gboolean
 read_output(int fd, gpointer user_data)
 {
@@ -78,16 +163,27 @@ read_output(int fd, gpointer user_data)
             sprintf(data + len, "%s", buf);
             len += rc;
 
+            if (op->opaque->output_callback) {
+                stream_output(op, is_err, buf, rc);
+            }
+
         } else if (errno != EINTR) {
             /* error or EOF
              * Cleanup happens in pipe_done()
              */
+            if (rc == 0 && op->opaque->output_callback) {
+                stream_flush(op, is_err);
+            }
             rc = FALSE;
             break;
         }
 
     } while (rc == buf_read_len || rc < 0);
 
+    if (op->opaque->output_callback) {
+        data = trim_output(op, data, &len);
+    }
+
     if (data != NULL && is_err) {
         op->stderr_data = data;
     } else if (data != NULL) {
@@ -123,62 +219,214 @@ pipe_err_done(gpointer user_data)
 }
 
 static void
-set_ocf_env(gpointer key, gpointer value, gpointer user_data)
+add_env(GPtrArray *env, const char *key, const char *value)
 {
-    if (setenv(key, value, 1) != 0) {
-        mh_err("setenv failed in raexecocf.");
-    }
+    g_ptr_array_add(env, g_strdup_printf("%s=%s", key, value));
 }
 
 static void
-set_ocf_env_with_prefix(gpointer key, gpointer value, gpointer user_data)
+add_ocf_param(gpointer key, gpointer value, gpointer user_data)
 {
-    /* TODO: Add OCF_RESKEY_ prefix to 'key' */
-    char buffer[500];
-    snprintf(buffer, sizeof(buffer), "OCF_RESKEY_%s", (char *) key);
-    set_ocf_env(buffer, value, user_data);
+    g_ptr_array_add((GPtrArray *) user_data,
+                    g_strdup_printf("OCF_RESKEY_%s=%s", (char *) key,
+                                    (char *) value));
 }
 
-static void
-add_OCF_env_vars(svc_action_t *op)
+/* "provider/agent" -> GPtrArray of the variables every action gets */
+static GHashTable *ocf_env_templates = NULL;
+
+/**
+ * \internal
+ * \brief Get the part of the environment shared by all actions of an agent
+ *
+ * That is our own environment, minus any OCF variables, plus the OCF
+ * variables that only depend on the agent.  Templates are built on first
+ * use and kept for the lifetime of the process.
+ */
+static GPtrArray *
+ocf_env_template(svc_action_t *op)
 {
-    if (!op->standard || strcasecmp("ocf", op->standard) != 0) {
-        return;
-    }
+    GPtrArray *env;
+    char **lpc;
+    char *key;
 
-    if (op->params) {
-        g_hash_table_foreach(op->params, set_ocf_env_with_prefix, NULL);
+    key = g_strdup_printf("%s/%s", op->provider ? op->provider : "",
+                          op->agent ? op->agent : "");
+
+    if (ocf_env_templates == NULL) {
+        ocf_env_templates = g_hash_table_new_full(g_str_hash, g_str_equal,
+                g_free, (GDestroyNotify) g_ptr_array_unref);
+
+    } else if ((env = g_hash_table_lookup(ocf_env_templates, key))) {
+        g_free(key);
+        return env;
     }
 
-    set_ocf_env("OCF_RA_VERSION_MAJOR", "1", NULL);
-    set_ocf_env("OCF_RA_VERSION_MINOR", "0", NULL);
-    set_ocf_env("OCF_ROOT", OCF_ROOT, NULL);
+    env = g_ptr_array_new_with_free_func(g_free);
 
-    if (op->rsc) {
-        set_ocf_env("OCF_RESOURCE_INSTANCE", op->rsc, NULL);
+    for (lpc = environ; lpc && *lpc; lpc++) {
+        /* The OCF variables set below always take precedence */
+        if (strncmp(*lpc, "OCF_", 4) != 0) {
+            g_ptr_array_add(env, g_strdup(*lpc));
+        }
     }
 
+    add_env(env, "OCF_RA_VERSION_MAJOR", "1");
+    add_env(env, "OCF_RA_VERSION_MINOR", "0");
+    add_env(env, "OCF_ROOT", OCF_ROOT);
+
     if (op->agent != NULL) {
-        set_ocf_env("OCF_RESOURCE_TYPE", op->agent, NULL);
+        add_env(env, "OCF_RESOURCE_TYPE", op->agent);
     }
 
     /* Notes: this is not added to specification yet. Sept 10,2004 */
     if (op->provider != NULL) {
-        set_ocf_env("OCF_RESOURCE_PROVIDER", op->provider, NULL);
+        add_env(env, "OCF_RESOURCE_PROVIDER", op->provider);
     }
+
+    g_hash_table_insert(ocf_env_templates, key, env);
+    return env;
 }
 
-static gboolean recurring_action_timer(gpointer data)
+/**
+ * \internal
+ * \brief Get the environment an action is executed with
+ *
+ * This is built in the parent, so that nothing has to be allocated between
+ * creating the child and exec'ing the agent, and only once per action, so
+ * that recurring actions reuse it.  The array borrows the agent's template
+ * and only owns the variables specific to this action.
+ *
+ * \return NULL terminated array owned by the action, or NULL if the action
+ *         simply inherits our environment.
+ */
+static char **
+action_environment(svc_action_t *op)
 {
-    svc_action_t *op = data;
-    mh_debug("Scheduling another invokation of %s", op->id);
+    GPtrArray *template;
+    GPtrArray *own;
+    guint lpc, n = 0;
+
+    if (op->opaque->envp) {
+        return op->opaque->envp;
+    }
 
-    /* Clean out the old result */
-    free(op->stdout_data); op->stdout_data = NULL;
-    free(op->stderr_data); op->stderr_data = NULL;
+    if (!op->standard || strcasecmp("ocf", op->standard) != 0) {
+        return NULL;
+    }
 
-    services_action_async(op, NULL);
-    return FALSE;
+    template = ocf_env_template(op);
+
+    own = g_ptr_array_new_with_free_func(g_free);
+
+    if (op->params) {
+        g_hash_table_foreach(op->params, add_ocf_param, own);
+    }
+
+    if (op->rsc) {
+        add_env(own, "OCF_RESOURCE_INSTANCE", op->rsc);
+    }
+
+    op->opaque->envp = g_new(char *, template->len + own->len + 1);
+
+    for (lpc = 0; lpc < template->len; lpc++) {
+        op->opaque->envp[n++] = g_ptr_array_index(template, lpc);
+    }
+    for (lpc = 0; lpc < own->len; lpc++) {
+        op->opaque->envp[n++] = g_ptr_array_index(own, lpc);
+    }
+    op->opaque->envp[n] = NULL;
+
+    op->opaque->env_strings = own;
+    return op->opaque->envp;
+}
+
+static int
+exec_error_to_rc(int error)
+{
+    switch (error) { /* see execve(2) */
+    case ENOENT:  /* No such file or directory */
+    case EISDIR:   /* Is a directory */
+        return OCF_NOT_INSTALLED;
+    case EACCES:   /* permission denied (various errors) */
+        return OCF_INSUFFICIENT_PRIV;
+    default:
+        return OCF_UNKNOWN_ERROR;
+    }
+}
+
+/* Units of ru_inblock and ru_oublock */
+#define RUSAGE_BLOCK_SIZE 512
+
+static inline unsigned int
+timeval_to_ms(const struct timeval *tv)
+{
+    return tv->tv_sec * 1000 + tv->tv_usec / 1000;
+}
+
+/**
+ * \internal
+ * \brief Record the resources used by an action's reaped process
+ */
+static void
+record_usage(svc_action_t *op, const struct rusage *ru)
+{
+    services_usage_t *usage = &op->opaque->usage;
+
+    usage->user_ms = timeval_to_ms(&ru->ru_utime);
+    usage->system_ms = timeval_to_ms(&ru->ru_stime);
+    usage->max_rss_kb = ru->ru_maxrss;
+    usage->read_bytes = (guint64) ru->ru_inblock * RUSAGE_BLOCK_SIZE;
+    usage->write_bytes = (guint64) ru->ru_oublock * RUSAGE_BLOCK_SIZE;
+}
+
+/* Most output kept from a memfd, anything beyond it is discarded */
+#define MEMFD_OUTPUT_MAX (1024 * 1024)
+
+/**
+ * \internal
+ * \brief Collect what the child wrote to a memfd, and close it
+ */
+static void
+read_memfd(svc_action_t *op, int *fd, char **data)
+{
+    struct stat sb;
+    char *buffer = NULL;
+    size_t len = 0;
+    size_t size = 0;
+
+    /* The child's writes moved the shared offset, so read from the start */
+    if (fstat(*fd, &sb) == 0 && sb.st_size > 0) {
+        size = sb.st_size;
+        if (size > MEMFD_OUTPUT_MAX) {
+            mh_warn("%s:%d - discarding all but the first %d of %zu bytes "
+                    "of output", op->id, op->pid, MEMFD_OUTPUT_MAX, size);
+            size = MEMFD_OUTPUT_MAX;
+        }
+        buffer = malloc(size + 1);
+
+        while (len < size) {
+            ssize_t rc = pread(*fd, buffer + len, size - len, len);
+
+            if (rc < 0 && errno == EINTR) {
+                continue;
+            } else if (rc <= 0) {
+                break;
+            }
+            len += rc;
+        }
+        buffer[len] = 0;
+    }
+
+    if (len > 0) {
+        free(*data);
+        *data = buffer;
+    } else {
+        free(buffer);
+    }
+
+    close(*fd);
+    *fd = -1;
 }
 
 static void
@@ -187,11 +435,16 @@ operation_finished(mainloop_child_t *p, int status, int signo, int exitcode)
     char *next = NULL;
     char *offset = NULL;
     svc_action_t *op = p->privatedata;
-    int recurring = 0;
 
     p->privatedata = NULL;
     op->status = LRM_OP_DONE;
     MH_ASSERT(op->pid == p->pid);
+    record_usage(op, &p->rusage);
+
+    if (op->opaque->output_memfd) {
+        read_memfd(op, &op->opaque->stdout_fd, &op->stdout_data);
+        read_memfd(op, &op->opaque->stderr_fd, &op->stderr_data);
+    }
 
     if (signo) {
         if (p->timeout) {
@@ -240,52 +493,104 @@ operation_finished(mainloop_child_t *p, int status, int signo, int exitcode)
         }
     }
 
-    if (op->interval) {
-        recurring = 1;
-        op->opaque->repeat_timer = g_timeout_add(op->interval,
-                                                 recurring_action_timer,
-                                                 (void *) op);
+    if (op->opaque->output_callback) {
+        stream_flush(op, FALSE);
+        stream_flush(op, TRUE);
     }
 
-    op->pid = 0;
+    services_action_finalize(op);
+}
+
+/* Complete an action that was answered without running its child */
+static gboolean
+operation_finished_early(gpointer data)
+{
+    services_action_finalize((svc_action_t *) data);
+    return FALSE;
+}
 
-    if (op->opaque->callback) {
-        op->opaque->callback(op);
+#ifdef USE_POSIX_SPAWN
+
+/**
+ * \internal
+ * \brief Launch an action with posix_spawn()
+ *
+ * All of the work that used to happen in a fork()ed child is described up
+ * front as spawn attributes and file actions, so glibc can use a vfork-style
+ * clone and a single close_range() rather than one close() per possible
+ * descriptor.
+ *
+ * \return 0 on success, otherwise an errno value
+ */
+static int
+action_launch(svc_action_t *op, int stdout_fd[2], int stderr_fd[2],
+              char **envp)
+{
+    int rc;
+    pid_t pid = 0;
+    posix_spawnattr_t attr;
+    posix_spawn_file_actions_t file_actions;
+
+    if ((rc = posix_spawnattr_init(&attr)) != 0) {
+        return rc;
     }
 
-    if (!recurring) {
-        /*
-         * If this is a recurring action, do not free explicitly.
-         * It will get freed whenever the action gets cancelled.
-         */
-        services_action_free(op);
+    if ((rc = posix_spawn_file_actions_init(&file_actions)) != 0) {
+        posix_spawnattr_destroy(&attr);
+        return rc;
     }
+
+    /* Equivalent of setpgid(0, 0) in the child */
+    posix_spawnattr_setpgroup(&attr, 0);
+    posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETPGROUP);
+
+    posix_spawn_file_actions_adddup2(&file_actions, stdout_fd[1],
+                                     STDOUT_FILENO);
+    posix_spawn_file_actions_adddup2(&file_actions, stderr_fd[1],
+                                     STDERR_FILENO);
+
+    /* close all descriptors except stdin/out/err */
+    posix_spawn_file_actions_addclosefrom_np(&file_actions,
+                                             STDERR_FILENO + 1);
+
+    rc = posix_spawnp(&pid, op->opaque->exec, &file_actions, &attr,
+                      op->opaque->args, envp ? envp : environ);
+    if (rc == 0) {
+        op->pid = pid;
+    }
+
+    posix_spawn_file_actions_destroy(&file_actions);
+    posix_spawnattr_destroy(&attr);
+
+    return rc;
 }
 
-gboolean
-services_os_action_execute(svc_action_t* op, gboolean synchronous)
+#else /* USE_POSIX_SPAWN */
+
+static void
+close_inherited_fds(void)
 {
-    int rc, lpc;
-    int stdout_fd[2];
-    int stderr_fd[2];
+    int lpc;
 
-    if (pipe(stdout_fd) < 0) {
-        mh_perror(LOG_ERR, "pipe() failed");
+#ifdef HAVE_CLOSE_RANGE
+    if (close_range(STDERR_FILENO + 1, ~0U, 0) == 0) {
+        return;
     }
+#endif
 
-    if (pipe(stderr_fd) < 0) {
-        mh_perror(LOG_ERR, "pipe() failed");
+    for (lpc = getdtablesize() - 1; lpc > STDERR_FILENO; lpc--) {
+        close(lpc);
     }
+}
 
+static int
+action_launch(svc_action_t *op, int stdout_fd[2], int stderr_fd[2],
+              char **envp)
+{
     op->pid = fork();
     switch (op->pid) {
     case -1:
-        mh_perror(LOG_ERR, "fork() failed");
-        close(stdout_fd[0]);
-        close(stdout_fd[1]);
-        close(stderr_fd[0]);
-        close(stderr_fd[1]);
-        return FALSE;
+        return errno;
 
     case 0:                /* Child */
         /* Man: The call setpgrp() is equivalent to setpgid(0,0)
@@ -293,8 +598,13 @@ services_os_action_execute(svc_action_t* op, gboolean synchronous)
          * need to investigate if it works the same too.
          */
         setpgid(0, 0);
-        close(stdout_fd[0]);
-        close(stderr_fd[0]);
+        /* A memfd is both ends at once */
+        if (stdout_fd[0] != stdout_fd[1]) {
+            close(stdout_fd[0]);
+        }
+        if (stderr_fd[0] != stderr_fd[1]) {
+            close(stderr_fd[0]);
+        }
         if (STDOUT_FILENO != stdout_fd[1]) {
             if (dup2(stdout_fd[1], STDOUT_FILENO) != STDOUT_FILENO) {
                 mh_perror(LOG_ERR, "dup2() failed (stdout)");
@@ -308,72 +618,405 @@ services_os_action_execute(svc_action_t* op, gboolean synchronous)
             close(stderr_fd[1]);
         }
 
-        /* close all descriptors except stdin/out/err and channels to logd */
-        for (lpc = getdtablesize() - 1; lpc > STDERR_FILENO; lpc--) {
-            close(lpc);
+        /* close all descriptors except stdin/out/err */
+        close_inherited_fds();
+
+        /* execute the RA */
+        if (envp) {
+            execvpe(op->opaque->exec, op->opaque->args, envp);
+        } else {
+            execvp(op->opaque->exec, op->opaque->args);
         }
 
-        /* Setup environment correctly */
-        add_OCF_env_vars(op);
+        _exit(exec_error_to_rc(errno));
+    }
 
-        /* execute the RA */
-        execvp(op->opaque->exec, op->opaque->args);
+    return 0;
+}
 
-        switch (errno) { /* see execve(2) */
-        case ENOENT:  /* No such file or directory */
-        case EISDIR:   /* Is a directory */
-            rc = OCF_NOT_INSTALLED;
-            break;
-        case EACCES:   /* permission denied (various errors) */
-            rc = OCF_INSUFFICIENT_PRIV;
+#endif /* USE_POSIX_SPAWN */
+
+/* Longest pause between checks on a child when pidfds are unavailable */
+#define SYNC_POLL_MAX_MS 50
+
+/* How long synchronous actions without a timeout of their own may run */
+#define SYNC_DEFAULT_TIMEOUT_MS 1000
+
+#ifndef W_EXITCODE
+#  define W_EXITCODE(ret, sig) ((ret) << 8 | (sig))
+#endif
+
+static int
+open_pidfd(pid_t pid)
+{
+#ifdef SYS_pidfd_open
+    return syscall(SYS_pidfd_open, pid, 0);
+#else
+    errno = ENOSYS;
+    return -1;
+#endif
+}
+
+static void
+close_output_fd(int *fd)
+{
+    close(*fd);
+    *fd = -1;
+}
+
+/**
+ * \internal
+ * \brief Wait for the child of a synchronous action to exit
+ *
+ * The output pipes are drained while waiting, so a child that writes more
+ * than a pipe's worth of output cannot stall.  Where the kernel supports
+ * pidfds, the child's exit wakes us immediately; otherwise it is checked
+ * for at intervals growing from 1ms to SYNC_POLL_MAX_MS.
+ *
+ * \param[in]  op     the action, already launched
+ * \param[out] status the child's wait status
+ * \param[out] ru     the resources the child used
+ *
+ * \return TRUE if the child exited, FALSE if op->timeout, or
+ *         SYNC_DEFAULT_TIMEOUT_MS for actions without one, expired first.
+ */
+static gboolean
+action_wait_sync(svc_action_t *op, int *status, struct rusage *ru)
+{
+    gint64 deadline = g_get_monotonic_time();
+    int pidfd = open_pidfd(op->pid);
+    int backoff = 1;
+    gboolean exited = FALSE;
+    pid_t rc = 0;
+
+    if (op->timeout > 0) {
+        deadline += (gint64) op->timeout * 1000;
+    } else {
+        deadline += (gint64) SYNC_DEFAULT_TIMEOUT_MS * 1000;
+    }
+
+    while (!exited) {
+        struct pollfd fds[3];
+        int *owners[3];
+        int nfds = 0, timeout_ms, lpc;
+        gint64 now = g_get_monotonic_time();
+
+        if (now >= deadline) {
             break;
-        default:
-            rc = OCF_UNKNOWN_ERROR;
+        }
+        timeout_ms = (deadline - now + 999) / 1000;
+
+        if (op->opaque->stdout_fd >= 0) {
+            owners[nfds] = &op->opaque->stdout_fd;
+            fds[nfds].fd = op->opaque->stdout_fd;
+            fds[nfds++].events = POLLIN;
+        }
+        if (op->opaque->stderr_fd >= 0) {
+            owners[nfds] = &op->opaque->stderr_fd;
+            fds[nfds].fd = op->opaque->stderr_fd;
+            fds[nfds++].events = POLLIN;
+        }
+        if (pidfd >= 0) {
+            owners[nfds] = NULL;
+            fds[nfds].fd = pidfd;
+            fds[nfds++].events = POLLIN;
+
+        } else if (timeout_ms > backoff) {
+            timeout_ms = backoff;
+            backoff = MIN(backoff * 2, SYNC_POLL_MAX_MS);
+        }
+
+        if (poll(fds, nfds, timeout_ms) < 0 && errno != EINTR) {
+            mh_perror(LOG_ERR, "poll() failed");
             break;
         }
-        _exit(rc);
+
+        for (lpc = 0; lpc < nfds; lpc++) {
+            if (owners[lpc] == NULL || fds[lpc].revents == 0) {
+                continue;
+            }
+
+            if (fds[lpc].revents & POLLIN) {
+                read_output(fds[lpc].fd, op);
+
+            } else {
+                /* POLLHUP with nothing left to read, or an error */
+                close_output_fd(owners[lpc]);
+            }
+        }
+
+        rc = wait4(op->pid, status, WNOHANG, ru);
+        if (rc > 0) {
+            exited = TRUE;
+
+        } else if (rc < 0 && errno != EINTR) {
+            /* Reaped by someone else, so the real result is lost */
+            mh_perror(LOG_WARNING, "wait4(%d) failed", op->pid);
+            *status = W_EXITCODE(OCF_UNKNOWN_ERROR, 0);
+            memset(ru, 0, sizeof(*ru));
+            exited = TRUE;
+        }
     }
 
-    /* Only the parent reaches here */
-    close(stdout_fd[1]);
-    close(stderr_fd[1]);
+    if (pidfd >= 0) {
+        close(pidfd);
+    }
+    return exited;
+}
 
-    op->opaque->stdout_fd = stdout_fd[0];
-    set_fd_opts(op->opaque->stdout_fd, O_NONBLOCK);
+/* Longest pidfile contents that are not garbage */
+#define PIDFILE_MAX 32
 
+/**
+ * \internal
+ * \brief Find the process of a running LSB service from its pidfile
+ *
+ * This only recognises the unambiguous case: a pidfile naming a live
+ * process whose command name is the service's.  Anything else, including
+ * a missing or stale pidfile, is left for the init script to decide, as
+ * services do not all use a pidfile of that name.
+ *
+ * \return the service's pid if it is running, otherwise 0
+ */
+static pid_t
+lsb_pidfile_pid(const char *service)
+{
+    char *path = NULL;
+    char *contents = NULL;
+    char *end = NULL;
+    char comm[16];
+    gboolean running = FALSE;
+    FILE *file = NULL;
+    long pid;
+
+    if (strchr(service, '/') != NULL) {
+        return 0;
+    }
+
+    path = g_strdup_printf("%s/%s.pid", LSB_PID_DIR, service);
+    if (!g_file_get_contents(path, &contents, NULL, NULL)
+        || strlen(contents) > PIDFILE_MAX) {
+        goto done;
+    }
+
+    errno = 0;
+    pid = strtol(contents, &end, 10);
+    if (errno || end == contents || pid <= 1 || (*end && !g_ascii_isspace(*end))) {
+        goto done;
+    }
+
+    if (kill(pid, 0) < 0 && errno != EPERM) {
+        goto done;
+    }
+
+    /* The pid may have been reused since the pidfile was written */
+    g_free(path);
+    path = g_strdup_printf("/proc/%ld/comm", pid);
+    if ((file = fopen(path, "r")) == NULL) {
+        goto done;
+    }
+    if (fgets(comm, sizeof(comm), file) != NULL) {
+        size_t len = strcspn(comm, "\n");
+
+        comm[len] = 0;
+        /* The kernel truncates command names to 15 characters */
+        running = len > 0 && (strcmp(comm, service) == 0
+                              || (len == sizeof(comm) - 1
+                                  && strncmp(comm, service, len) == 0));
+    }
+    fclose(file);
+
+done:
+    g_free(contents);
+    g_free(path);
+    return running ? pid : 0;
+}
+
+/**
+ * \internal
+ * \brief Whether the output of an action may be captured in memfds
+ *
+ * Only short, read-only actions qualify.  Anything that may start a daemon
+ * (start, restart, a puppet run, ...) keeps pipes: a daemon inheriting a
+ * memfd as its stdout would keep it, and everything written to it, alive
+ * for as long as it runs, whereas a pipe fails once the agent closes it.
+ */
+static gboolean
+action_output_memfd(svc_action_t *op, gboolean synchronous)
+{
+    static const char *read_only[] = { "monitor", "status", "meta-data" };
+    int lpc;
+
+    if (synchronous || op->opaque->output_callback || op->action == NULL) {
+        return FALSE;
+    }
+
+    for (lpc = 0; lpc < DIMOF(read_only); lpc++) {
+        if (strcmp(op->action, read_only[lpc]) == 0) {
+            return TRUE;
+        }
+    }
+
+    return FALSE;
+}
+
+/**
+ * \internal
+ * \brief Create memfds to capture the output of an asynchronous action
+ *
+ * Unlike pipes, memfds need no mainloop sources and never wake the parent
+ * while the child runs.  Their contents are read once it has exited.  Each
+ * memfd is passed as both ends, as if it were a pipe.
+ *
+ * \return TRUE if both memfds were created
+ */
+static gboolean
+open_output_memfds(int stdout_fd[2], int stderr_fd[2])
+{
+#ifdef HAVE_MEMFD_CREATE
+    int out = memfd_create("matahari-stdout", MFD_CLOEXEC);
+    int err = -1;
+
+    if (out >= 0) {
+        err = memfd_create("matahari-stderr", MFD_CLOEXEC);
+    }
+
+    if (err < 0) {
+        mh_perror(LOG_DEBUG, "memfd_create() failed, using pipes");
+        if (out >= 0) {
+            close(out);
+        }
+        return FALSE;
+    }
+
+    stdout_fd[0] = stdout_fd[1] = out;
+    stderr_fd[0] = stderr_fd[1] = err;
+    return TRUE;
+#else
+    return FALSE;
+#endif
+}
+
+gboolean
+services_os_action_execute(svc_action_t* op, gboolean synchronous)
+{
+    int rc;
+    int stdout_fd[2];
+    int stderr_fd[2];
+
+    if (op->standard && strcasecmp(op->standard, "systemd") == 0
+        && systemd_unit_exec(op, synchronous)) {
+        return TRUE;
+    }
+
+    if (services_lsb_pidfile_status()
+        && op->standard && strcasecmp(op->standard, "lsb") == 0
+        && strcmp(op->action, "status") == 0
+        && lsb_pidfile_pid(op->agent) > 0) {
+        mh_trace("%s - running according to its pidfile", op->id);
+        op->pid = 0;
+        op->status = LRM_OP_DONE;
+        op->rc = LSB_STATUS_OK;
+
+        if (!synchronous) {
+            g_idle_add(operation_finished_early, op);
+        }
+        return TRUE;
+    }
+
+    op->opaque->output_memfd = action_output_memfd(op, synchronous)
+                               && open_output_memfds(stdout_fd, stderr_fd);
+
+    if (op->opaque->output_memfd) {
+        /* Nothing to set up */
+
+    } else if (pipe(stdout_fd) < 0) {
+        mh_perror(LOG_ERR, "pipe() failed");
+        return FALSE;
+
+    } else if (pipe(stderr_fd) < 0) {
+        mh_perror(LOG_ERR, "pipe() failed");
+        close(stdout_fd[0]);
+        close(stdout_fd[1]);
+        return FALSE;
+    }
+
+    rc = action_launch(op, stdout_fd, stderr_fd, action_environment(op));
+
+    if (!op->opaque->output_memfd) {
+        close(stdout_fd[1]);
+        close(stderr_fd[1]);
+    }
+
+    if (rc == EAGAIN || rc == ENOMEM) {
+        mh_err("Could not launch %s: %s", op->opaque->exec, strerror(rc));
+        close(stdout_fd[0]);
+        close(stderr_fd[0]);
+        return FALSE;
+
+    } else if (rc != 0) {
+        /* The agent could not be exec'd.  Report it the same way a child
+         * that failed to exec would have, rather than as a launch failure.
+         */
+        mh_warn("%s - could not execute %s: %s", op->id, op->opaque->exec,
+                strerror(rc));
+        close(stdout_fd[0]);
+        close(stderr_fd[0]);
+
+        op->pid = 0;
+        op->status = LRM_OP_DONE;
+        op->rc = exec_error_to_rc(rc);
+
+        if (!synchronous) {
+            g_idle_add(operation_finished_early, op);
+        }
+        return TRUE;
+    }
+
+    op->opaque->stdout_fd = stdout_fd[0];
     op->opaque->stderr_fd = stderr_fd[0];
+
+    if (op->opaque->output_memfd) {
+        mh_trace("Async waiting for %d - %s (output to memfds)", op->pid,
+                 op->opaque->exec);
+        mainloop_add_child(op->pid, op->timeout, op->id, op,
+                           operation_finished);
+        return TRUE;
+    }
+
+    set_fd_opts(op->opaque->stdout_fd, O_NONBLOCK);
     set_fd_opts(op->opaque->stderr_fd, O_NONBLOCK);
 
     if (synchronous) {
+        struct rusage ru;
         int status = 0;
-        int timeout = 1 + op->timeout / 1000;
-        mh_trace("Waiting for %d", op->pid);
-        while (timeout > 0 && waitpid(op->pid, &status, WNOHANG) <= 0) {
-            sleep(1);
-            timeout--;
-        }
 
-        mh_trace("Child done: %d", op->pid);
-        if (timeout == 0) {
+        mh_trace("Waiting for %d", op->pid);
+        if (action_wait_sync(op, &status, &ru) == FALSE) {
             int killrc = sigar_proc_kill(op->pid, 9 /*SIGKILL*/);
 
             op->status = LRM_OP_TIMEOUT;
+            op->rc = OCF_TIMEOUT;
             mh_warn("%s:%d - timed out after %dms", op->id, op->pid,
                     op->timeout);
 
             if (killrc != SIGAR_OK && killrc != ESRCH) {
                 mh_err("kill(%d, KILL) failed: %d", op->pid, killrc);
             }
+            if (wait4(op->pid, &status, 0, &ru) < 0) {
+                memset(&ru, 0, sizeof(ru));
+            }
 
         } else if (WIFEXITED(status)) {
             op->status = LRM_OP_DONE;
             op->rc = WEXITSTATUS(status);
-            mh_err("Managed %s process %d exited with rc=%d", op->id, op->pid,
-                   op->rc);
+            mh_debug("Managed %s process %d exited with rc=%d", op->id,
+                     op->pid, op->rc);
 
         } else if (WIFSIGNALED(status)) {
             int signo = WTERMSIG(status);
             op->status = LRM_OP_ERROR;
+            op->rc = OCF_SIGNAL;
             mh_err("Managed %s process %d exited with signal=%d", op->id,
                    op->pid, signo);
         }
@@ -382,9 +1025,19 @@ services_os_action_execute(svc_action_t* op, gboolean synchronous)
             mh_err("Managed %s process %d dumped core", op->id, op->pid);
         }
 #endif
+        record_usage(op, &ru);
 
-        read_output(op->opaque->stdout_fd, op);
-        read_output(op->opaque->stderr_fd, op);
+        /* Whatever is already buffered; descendants may hold the pipes open */
+        if (op->opaque->stdout_fd >= 0) {
+            read_output(op->opaque->stdout_fd, op);
+            close(op->opaque->stdout_fd);
+            op->opaque->stdout_fd = -1;
+        }
+        if (op->opaque->stderr_fd >= 0) {
+            read_output(op->opaque->stderr_fd, op);
+            close(op->opaque->stderr_fd);
+            op->opaque->stderr_fd = -1;
+        }
 
     } else {
         mh_trace("Async waiting for %d - %s", op->pid, op->opaque->exec);
@@ -401,56 +1054,231 @@ services_os_action_execute(svc_action_t* op, gboolean synchronous)
     return TRUE;
 }
 
-GList *
-services_os_get_directory_list(const char *root, gboolean files)
+static gint
+directory_entry_compare(gconstpointer a, gconstpointer b)
 {
-    GList *list = NULL;
-#if __linux__
-    struct dirent **namelist;
-    int entries = 0, lpc = 0;
-    char buffer[PATH_MAX];
+    return strcoll(*(const char **) a, *(const char **) b);
+}
 
-    entries = scandir(root, &namelist, NULL, alphasort);
-    if (entries <= 0) {
-        return list;
+/**
+ * \internal
+ * \brief Read the agents (or provider directories) found in a directory
+ *
+ * \param[in] root  directory to scan
+ * \param[in] files TRUE for executable files, FALSE for subdirectories
+ *
+ * \return a sorted array of names, owned by the caller
+ */
+static GPtrArray *
+directory_scan(const char *root, gboolean files)
+{
+    GPtrArray *entries = g_ptr_array_new_with_free_func(free);
+    struct dirent *entry;
+    DIR *dp;
+
+    if (!(dp = opendir(root))) {
+        return entries;
     }
 
-    for (lpc = 0; lpc < entries; lpc++) {
+    while ((entry = readdir(dp)) != NULL) {
         struct stat sb;
-        if ('.' == namelist[lpc]->d_name[0]) {
-            free(namelist[lpc]);
+
+        if ('.' == entry->d_name[0]) {
             continue;
         }
 
-        snprintf(buffer, sizeof(buffer), "%s/%s", root, namelist[lpc]->d_name);
+        if (fstatat(dirfd(dp), entry->d_name, &sb, 0) < 0) {
+            continue;
+        }
 
-        stat(buffer, &sb);
         if (S_ISDIR(sb.st_mode)) {
             if (files) {
-                free(namelist[lpc]);
                 continue;
             }
 
         } else if (S_ISREG(sb.st_mode)) {
             if (files == FALSE) {
-                free(namelist[lpc]);
                 continue;
 
-            } else if ((sb.st_mode & S_IXUSR) == 0
-                       && (sb.st_mode & S_IXGRP) == 0
-                       && (sb.st_mode & S_IXOTH) == 0) {
-                free(namelist[lpc]);
+            } else if ((sb.st_mode & (S_IXUSR | S_IXGRP | S_IXOTH)) == 0) {
                 continue;
             }
         }
 
-        list = g_list_append(list, strdup(namelist[lpc]->d_name));
+        g_ptr_array_add(entries, strdup(entry->d_name));
+    }
+
+    closedir(dp);
+
+    g_ptr_array_sort(entries, directory_entry_compare);
+    return entries;
+}
+
+static GList *
+directory_entries_to_list(GPtrArray *entries)
+{
+    GList *list = NULL;
+    guint lpc;
 
-        free(namelist[lpc]);
+    for (lpc = entries->len; lpc > 0; lpc--) {
+        list = g_list_prepend(list, strdup(g_ptr_array_index(entries, lpc - 1)));
+    }
+    return list;
+}
+
+#ifdef HAVE_SYS_INOTIFY_H
+
+/*
+ * Listings of /etc/init.d and the OCF provider tree are kept in memory and
+ * only rescanned once inotify reports that something in the directory
+ * changed.  Pending events are drained at the start of each lookup, so the
+ * catalogue is current whether or not the caller runs a main loop.
+ */
+
+#define CATALOGUE_EVENTS (IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO \
+                          | IN_ATTRIB | IN_CLOSE_WRITE | IN_DELETE_SELF \
+                          | IN_MOVE_SELF | IN_ONLYDIR)
+
+typedef struct dir_catalogue_s {
+    char *root;
+    gboolean files;
+    /*! Watch descriptor, -1 while the directory is not being watched */
+    int wd;
+    gboolean dirty;
+    GPtrArray *entries;
+} dir_catalogue_t;
+
+static GHashTable *catalogues = NULL;
+static int catalogue_fd = -1;
+
+static void
+catalogue_free(gpointer data)
+{
+    dir_catalogue_t *cat = data;
+
+    if (cat->entries) {
+        g_ptr_array_free(cat->entries, TRUE);
+    }
+    free(cat->root);
+    free(cat);
+}
+
+static void
+catalogue_invalidate(int wd, uint32_t mask)
+{
+    GHashTableIter iter;
+    dir_catalogue_t *cat;
+
+    g_hash_table_iter_init(&iter, catalogues);
+    while (g_hash_table_iter_next(&iter, NULL, (gpointer *) &cat)) {
+        if (mask & IN_Q_OVERFLOW) {
+            cat->dirty = TRUE;
+
+        } else if (cat->wd == wd) {
+            cat->dirty = TRUE;
+            if (mask & IN_IGNORED) {
+                /* The directory itself went away */
+                cat->wd = -1;
+            }
+        }
+    }
+}
+
+static void
+catalogue_drain(void)
+{
+    char buffer[4096]
+        __attribute__ ((aligned(__alignof__(struct inotify_event))));
+    ssize_t len;
+
+    while ((len = read(catalogue_fd, buffer, sizeof(buffer))) > 0) {
+        char *ptr = buffer;
+
+        while (ptr < buffer + len) {
+            const struct inotify_event *event = (const struct inotify_event *) ptr;
+
+            catalogue_invalidate(event->wd, event->mask);
+            ptr += sizeof(struct inotify_event) + event->len;
+        }
+    }
+}
+
+static dir_catalogue_t *
+catalogue_get(const char *root, gboolean files)
+{
+    static gboolean unavailable = FALSE;
+    dir_catalogue_t *cat;
+    char *key;
+
+    if (unavailable) {
+        return NULL;
+    }
+
+    if (catalogue_fd < 0) {
+        if ((catalogue_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC)) < 0) {
+            mh_warn("Could not watch agent directories, listings will not "
+                    "be cached: %s", strerror(errno));
+            unavailable = TRUE;
+            return NULL;
+        }
+        catalogues = g_hash_table_new_full(g_str_hash, g_str_equal, g_free,
+                                           catalogue_free);
+    }
+
+    catalogue_drain();
+
+    key = g_strdup_printf("%c%s", files ? 'f' : 'd', root);
+    cat = g_hash_table_lookup(catalogues, key);
+    if (cat == NULL) {
+        cat = calloc(1, sizeof(dir_catalogue_t));
+        cat->root = strdup(root);
+        cat->files = files;
+        cat->wd = -1;
+        g_hash_table_insert(catalogues, key, cat);
+    } else {
+        g_free(key);
+    }
+
+    if (cat->wd < 0) {
+        /* Watch before scanning so that no change can slip in between */
+        if ((cat->wd = inotify_add_watch(catalogue_fd, root,
+                                         CATALOGUE_EVENTS)) < 0) {
+            return NULL;
+        }
+        cat->dirty = TRUE;
     }
 
-    free(namelist);
+    if (cat->dirty) {
+        mh_trace("Rescanning %s", root);
+        if (cat->entries) {
+            g_ptr_array_free(cat->entries, TRUE);
+        }
+        cat->entries = directory_scan(root, files);
+        cat->dirty = FALSE;
+    }
+
+    return cat;
+}
+
+#endif /* HAVE_SYS_INOTIFY_H */
+
+GList *
+services_os_get_directory_list(const char *root, gboolean files)
+{
+    GPtrArray *entries;
+    GList *list;
+
+#ifdef HAVE_SYS_INOTIFY_H
+    dir_catalogue_t *cat = catalogue_get(root, files);
+
+    if (cat) {
+        return directory_entries_to_list(cat->entries);
+    }
 #endif
+
+    entries = directory_scan(root, files);
+    list = directory_entries_to_list(entries);
+    g_ptr_array_free(entries, TRUE);
     return list;
 }
 
@@ -515,6 +1343,10 @@ resources_os_list_systemd_services(void)
     const char *args[] = { "list-units", "--all", "--type=service", "--full",
                            "--no-pager", NULL };
 
+    if (systemd_unit_list(&list)) {
+        return list;
+    }
+
     if (!(action = mh_services_action_create_generic(SYSTEMCTL, args))) {
         return NULL;
     }
@@ -543,3 +1375,103 @@ resources_os_list_systemd_services(void)
     services_action_free(action);
     return list;
 }
+
+typedef struct service_watch_s {
+    char          *name;
+    pid_t          pid;
+    int            fd;
+    mainloop_fd_t *source;
+
+    void (*callback)(const char *name, pid_t pid, void *user_data);
+    void  *user_data;
+} service_watch_t;
+
+/* Service name -> service_watch_t */
+static GHashTable *service_watches = NULL;
+
+static gboolean
+service_watch_exited(int fd, gpointer user_data)
+{
+    service_watch_t *watch = user_data;
+
+    mh_info("Service %s (pid %d) exited", watch->name, watch->pid);
+
+    /* The callback may watch the service's next process */
+    g_hash_table_remove(service_watches, watch->name);
+    watch->source = NULL;
+    watch->callback(watch->name, watch->pid, watch->user_data);
+    return FALSE;
+}
+
+static void
+service_watch_free(gpointer user_data)
+{
+    service_watch_t *watch = user_data;
+
+    close(watch->fd);
+    free(watch->name);
+    free(watch);
+}
+
+pid_t
+services_os_watch(const char *name,
+                  void (*callback)(const char *name, pid_t pid,
+                                   void *user_data),
+                  void *user_data)
+{
+    service_watch_t *watch = NULL;
+    pid_t pid = 0;
+    int fd;
+
+    if (g_file_test(SYSTEMCTL, G_FILE_TEST_IS_REGULAR)) {
+        pid = systemd_unit_main_pid(name);
+    }
+    if (pid <= 0) {
+        pid = lsb_pidfile_pid(name);
+    }
+    if (pid <= 0) {
+        mh_info("Could not find the process of service %s", name);
+        return 0;
+    }
+
+    /* Unlike a pid, a pidfd cannot come to refer to a different process */
+    fd = open_pidfd(pid);
+    if (fd < 0) {
+        mh_perror(LOG_WARNING, "Could not watch service %s (pid %d)",
+                  name, pid);
+        return 0;
+    }
+
+    services_os_unwatch(name);
+    if (service_watches == NULL) {
+        service_watches = g_hash_table_new(g_str_hash, g_str_equal);
+    }
+
+    watch = calloc(1, sizeof(service_watch_t));
+    watch->name = strdup(name);
+    watch->pid = pid;
+    watch->fd = fd;
+    watch->callback = callback;
+    watch->user_data = user_data;
+    watch->source = mainloop_add_fd(G_PRIORITY_HIGH, fd, service_watch_exited,
+                                    service_watch_free, watch);
+
+    g_hash_table_insert(service_watches, watch->name, watch);
+    mh_debug("Watching service %s (pid %d)", name, pid);
+    return pid;
+}
+
+gboolean
+services_os_unwatch(const char *name)
+{
+    service_watch_t *watch = NULL;
+
+    if (service_watches == NULL
+        || (watch = g_hash_table_lookup(service_watches, name)) == NULL) {
+        return FALSE;
+    }
+
+    g_hash_table_remove(service_watches, name);
+    mainloop_destroy_fd(watch->source);
+    return TRUE;
+}
@@ -0,0 +1,331 @@
+/*
+ * Copyright (C) 2012 Red Hat, Inc.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+/**
+ * \file
+ * \brief Cache of resource agent meta-data
+ *
+ * The meta-data of an OCF agent only changes when the agent itself does,
+ * so the output of a successful meta-data action is kept, keyed by the
+ * agent's path and stamped with its mtime (in nanoseconds), size and inode.
+ * Entries are also written to METADATA_DIR so that they survive a restart.
+ */
+
+#include "config.h"
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <errno.h>
+#include <string.h>
+#include <glib/gstdio.h>
+
+#include "matahari/logging.h"
+#include "matahari/services.h"
+#include "services_private.h"
+
+#define METADATA_DIR   LOCAL_STATE_DIR "/lib/matahari/metadata"
+#define METADATA_GROUP "metadata"
+
+/* Timeout for meta-data actions run by resources_get_metadata*() */
+#define METADATA_TIMEOUT_MS 30000
+
+typedef struct metadata_entry_s {
+    guint64 mtime_ns;
+    guint64 size;
+    guint64 inode;
+    char   *xml;
+} metadata_entry_t;
+
+/* Agent path -> metadata_entry_t */
+static GHashTable *metadata_cache = NULL;
+
+static void
+metadata_entry_free(gpointer data)
+{
+    metadata_entry_t *entry = data;
+
+    free(entry->xml);
+    free(entry);
+}
+
+static gboolean
+metadata_applies(svc_action_t *op)
+{
+    return op->interval == 0
+        && op->standard && strcasecmp(op->standard, "ocf") == 0
+        && op->action && strcmp(op->action, "meta-data") == 0
+        && op->opaque->exec;
+}
+
+/* Whole seconds would miss an agent rewritten within the same second */
+static guint64
+metadata_mtime_ns(struct stat *sb)
+{
+    return (guint64) sb->st_mtim.tv_sec * 1000000000 + sb->st_mtim.tv_nsec;
+}
+
+static gboolean
+metadata_matches(metadata_entry_t *entry, struct stat *sb)
+{
+    return entry->mtime_ns == metadata_mtime_ns(sb)
+        && entry->size == (guint64) sb->st_size
+        && entry->inode == (guint64) sb->st_ino;
+}
+
+static char *
+metadata_file(const char *path)
+{
+    char *digest = g_compute_checksum_for_string(G_CHECKSUM_SHA1, path, -1);
+    char *file = g_strdup_printf("%s/%s", METADATA_DIR, digest);
+
+    g_free(digest);
+    return file;
+}
+
+static guint64
+metadata_get_number(GKeyFile *keyfile, const char *key)
+{
+    char *value = g_key_file_get_value(keyfile, METADATA_GROUP, key, NULL);
+    guint64 number = 0;
+
+    if (value) {
+        number = g_ascii_strtoull(value, NULL, 10);
+        g_free(value);
+    }
+    return number;
+}
+
+static metadata_entry_t *
+metadata_load(const char *path)
+{
+    metadata_entry_t *entry = NULL;
+    GKeyFile *keyfile = g_key_file_new();
+    char *file = metadata_file(path);
+    char *stored_path = NULL;
+    char *xml = NULL;
+
+    if (!g_key_file_load_from_file(keyfile, file, G_KEY_FILE_NONE, NULL)) {
+        goto done;
+    }
+
+    stored_path = g_key_file_get_string(keyfile, METADATA_GROUP, "path", NULL);
+    xml = g_key_file_get_string(keyfile, METADATA_GROUP, "xml", NULL);
+
+    if (stored_path == NULL || xml == NULL || strcmp(stored_path, path) != 0) {
+        goto done;
+    }
+
+    entry = calloc(1, sizeof(metadata_entry_t));
+    entry->mtime_ns = metadata_get_number(keyfile, "mtime_ns");
+    entry->size = metadata_get_number(keyfile, "size");
+    entry->inode = metadata_get_number(keyfile, "inode");
+    entry->xml = strdup(xml);
+
+done:
+    g_free(stored_path);
+    g_free(xml);
+    g_free(file);
+    g_key_file_free(keyfile);
+    return entry;
+}
+
+static void
+metadata_save(const char *path, metadata_entry_t *entry)
+{
+    GKeyFile *keyfile = NULL;
+    GError *error = NULL;
+    char *file = NULL;
+    char *data = NULL;
+    char number[32];
+    gsize len = 0;
+
+    if (g_mkdir_with_parents(METADATA_DIR, 0755) < 0) {
+        mh_debug("Could not create %s: %s", METADATA_DIR, strerror(errno));
+        return;
+    }
+
+    keyfile = g_key_file_new();
+    g_key_file_set_string(keyfile, METADATA_GROUP, "path", path);
+
+    g_snprintf(number, sizeof(number), "%" G_GUINT64_FORMAT, entry->mtime_ns);
+    g_key_file_set_value(keyfile, METADATA_GROUP, "mtime_ns", number);
+    g_snprintf(number, sizeof(number), "%" G_GUINT64_FORMAT, entry->size);
+    g_key_file_set_value(keyfile, METADATA_GROUP, "size", number);
+    g_snprintf(number, sizeof(number), "%" G_GUINT64_FORMAT, entry->inode);
+    g_key_file_set_value(keyfile, METADATA_GROUP, "inode", number);
+
+    g_key_file_set_string(keyfile, METADATA_GROUP, "xml", entry->xml);
+
+    data = g_key_file_to_data(keyfile, &len, NULL);
+    file = metadata_file(path);
+
+    if (!g_file_set_contents(file, data, len, &error)) {
+        mh_debug("Could not save meta-data for %s: %s", path, error->message);
+        g_error_free(error);
+    }
+
+    g_free(file);
+    g_free(data);
+    g_key_file_free(keyfile);
+}
+
+char *
+services_metadata_lookup(svc_action_t *op)
+{
+    metadata_entry_t *entry = NULL;
+    const char *path = NULL;
+    struct stat sb;
+
+    if (!metadata_applies(op)) {
+        return NULL;
+    }
+
+    path = op->opaque->exec;
+    if (g_stat(path, &sb) < 0) {
+        return NULL;
+    }
+
+    if (metadata_cache == NULL) {
+        metadata_cache = g_hash_table_new_full(g_str_hash, g_str_equal, free,
+                                               metadata_entry_free);
+    }
+
+    entry = g_hash_table_lookup(metadata_cache, path);
+    if (entry == NULL && (entry = metadata_load(path))) {
+        g_hash_table_insert(metadata_cache, strdup(path), entry);
+    }
+
+    if (entry == NULL || !metadata_matches(entry, &sb)) {
+        return NULL;
+    }
+
+    mh_trace("Using cached meta-data for %s", path);
+    return strdup(entry->xml);
+}
+
+void
+services_metadata_store(svc_action_t *op)
+{
+    metadata_entry_t *entry = NULL;
+    struct stat sb;
+
+    if (!metadata_applies(op) || op->status != LRM_OP_DONE
+        || op->rc != OCF_OK || mh_strlen_zero(op->stdout_data)) {
+        return;
+    }
+
+    if (g_stat(op->opaque->exec, &sb) < 0) {
+        return;
+    }
+
+    if (metadata_cache == NULL) {
+        metadata_cache = g_hash_table_new_full(g_str_hash, g_str_equal, free,
+                                               metadata_entry_free);
+    }
+
+    entry = calloc(1, sizeof(metadata_entry_t));
+    entry->mtime_ns = metadata_mtime_ns(&sb);
+    entry->size = sb.st_size;
+    entry->inode = sb.st_ino;
+    entry->xml = strdup(op->stdout_data);
+
+    g_hash_table_replace(metadata_cache, strdup(op->opaque->exec), entry);
+    metadata_save(op->opaque->exec, entry);
+}
+
+char *
+resources_get_metadata(const char *standard, const char *provider,
+                       const char *agent)
+{
+    svc_action_t *op = NULL;
+    char *xml = NULL;
+
+    if (mh_strlen_zero(standard) || strcasecmp(standard, "ocf") != 0) {
+        return NULL;
+    }
+
+    op = resources_action_create(agent, standard, provider, agent,
+                                 "meta-data", 0, METADATA_TIMEOUT_MS, NULL);
+    if (op == NULL) {
+        return NULL;
+    }
+
+    if (services_action_sync(op) && op->rc == OCF_OK && op->stdout_data) {
+        xml = op->stdout_data;
+        op->stdout_data = NULL;
+    }
+
+    services_action_free(op);
+    return xml;
+}
+
+struct metadata_request {
+    void (*callback)(const char *xml, void *user_data);
+    void *user_data;
+};
+
+static void
+metadata_request_done(svc_action_t *op)
+{
+    struct metadata_request *request = op->cb_data;
+    const char *xml = NULL;
+
+    if (op->status == LRM_OP_DONE && op->rc == OCF_OK
+        && !mh_strlen_zero(op->stdout_data)) {
+        xml = op->stdout_data;
+    }
+
+    request->callback(xml, request->user_data);
+
+    free(request);
+    op->cb_data = NULL;
+}
+
+gboolean
+resources_get_metadata_async(const char *standard, const char *provider,
+                             const char *agent,
+                             void (*callback)(const char *xml,
+                                              void *user_data),
+                             void *user_data)
+{
+    svc_action_t *op = NULL;
+    struct metadata_request *request = NULL;
+
+    if (mh_strlen_zero(standard) || strcasecmp(standard, "ocf") != 0) {
+        return FALSE;
+    }
+
+    op = resources_action_create(agent, standard, provider, agent,
+                                 "meta-data", 0, METADATA_TIMEOUT_MS, NULL);
+    if (op == NULL) {
+        return FALSE;
+    }
+
+    request = calloc(1, sizeof(struct metadata_request));
+    request->callback = callback;
+    request->user_data = user_data;
+    op->cb_data = request;
+
+    if (!services_action_async(op, metadata_request_done)) {
+        free(request);
+        services_action_free(op);
+        return FALSE;
+    }
+
+    return TRUE;
+}
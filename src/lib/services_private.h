@@ -23,7 +23,6 @@ struct svc_action_private_s {
     char *exec;
     char *args[7];
 
-    guint repeat_timer;
     void (*callback)(svc_action_t *op);
 
     int            stderr_fd;
@@ -31,8 +30,80 @@ struct svc_action_private_s {
 
     int            stdout_fd;
     mainloop_fd_t *stdout_gsource;
+
+    /* Output goes to memfds that are read once the child exits */
+    gboolean       output_memfd;
+
+    /* Output streaming, see services_action_stream_output() */
+    void   (*output_callback)(svc_action_t *op, gboolean is_stderr,
+                              const char *data, size_t len);
+    size_t   output_tail;
+    GString *output_partial[2];
+
+    /* Environment to execute with, see action_environment() */
+    char         **envp;
+    GPtrArray     *env_strings;
+
+    /* Scheduling state, managed by services.c */
+    gboolean queued;
+    gboolean running;
+    gboolean cancelled;
+    gint64   queued_at;
+    gint64   started_at;
+    unsigned int wait_ms;
+    unsigned int run_ms;
+    /* Filled in by the OS specific code, except for wall_ms */
+    services_usage_t usage;
+
+    /* Identical read-only actions sharing this one's result */
+    char    *flight_key;
+    GList   *followers;
+
+    /* systemd job being waited for, see services_systemd.c */
+    char    *job;
+    guint    job_timer;
+
+    /* Recurring actions only, see services.c */
+    struct recurring_cohort_s *cohort;
+    gint64   next_due;
 };
 
+/**
+ * \internal
+ * \brief Complete an asynchronous action
+ *
+ * Called by the OS specific code once an action launched with
+ * services_os_action_execute() has finished.  This releases the action's
+ * execution slot, reschedules recurring actions, invokes the callback and
+ * frees one-shot actions.
+ */
+void
+services_action_finalize(svc_action_t *op);
+
+/**
+ * \internal
+ * \brief Get the cached output of an OCF meta-data action
+ *
+ * \return the agent's meta-data if it has not changed since it was stored,
+ *         to be freed with free(), or NULL
+ */
+char *
+services_metadata_lookup(svc_action_t *op);
+
+/**
+ * \internal
+ * \brief Remember the output of a successful OCF meta-data action
+ */
+void
+services_metadata_store(svc_action_t *op);
+
+/**
+ * \internal
+ * \brief Whether LSB status actions may be answered from a pidfile
+ */
+gboolean
+services_lsb_pidfile_status(void);
+
 GList *
 services_os_get_directory_list(const char *root, gboolean files);
 
@@ -54,4 +125,42 @@ resources_os_list_ocf_agents(const char *provider);
 GList *
 resources_os_list_systemd_services(void);
 
+pid_t
+services_os_watch(const char *name,
+                  void (*callback)(const char *name, pid_t pid,
+                                   void *user_data),
+                  void *user_data);
+
+gboolean
+services_os_unwatch(const char *name);
+
+/**
+ * \internal
+ * \brief Execute a systemd action over D-Bus
+ *
+ * \retval TRUE the action was handled (or, if asynchronous, started)
+ * \retval FALSE D-Bus is not available for this action, use systemctl
+ */
+gboolean
+systemd_unit_exec(svc_action_t *op, gboolean synchronous);
+
+/**
+ * \internal
+ * \brief List systemd services over D-Bus
+ *
+ * \retval TRUE \p units was filled in
+ * \retval FALSE D-Bus is not available, use systemctl
+ */
+gboolean
+systemd_unit_list(GList **units);
+
+/**
+ * \internal
+ * \brief Get the main process of a systemd service over D-Bus
+ *
+ * \return the pid, or 0 if the unit has none or D-Bus is not available
+ */
+pid_t
+systemd_unit_main_pid(const char *agent);
+
 #endif /* __MH_SERVICES_PRIVATE_H__ */
@@ -0,0 +1,735 @@
+/*
+ * Copyright (C) 2012 Red Hat, Inc.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+/*
+ * systemd units are controlled through the org.freedesktop.systemd1 D-Bus
+ * API rather than by running systemctl.  Start and stop requests complete
+ * when systemd reports the job as removed, and status is read from the
+ * unit's ActiveState.  Anything that cannot be done over D-Bus (no system
+ * bus, no systemd, enable/disable) falls back to executing systemctl.
+ */
+
+#include "config.h"
+
+#include <string.h>
+
+#include "matahari/logging.h"
+#include "matahari/mainloop.h"
+#include "matahari/services.h"
+#include "matahari/utilities.h"
+#include "services_private.h"
+
+#ifdef HAVE_GDBUS
+
+#include <gio/gio.h>
+
+#define SYSTEMD_BUS_NAME      "org.freedesktop.systemd1"
+#define SYSTEMD_OBJECT_PATH   "/org/freedesktop/systemd1"
+#define SYSTEMD_MANAGER_IFACE SYSTEMD_BUS_NAME ".Manager"
+#define SYSTEMD_UNIT_IFACE    SYSTEMD_BUS_NAME ".Unit"
+#define SYSTEMD_JOB_IFACE     SYSTEMD_BUS_NAME ".Job"
+#define SYSTEMD_SERVICE_IFACE SYSTEMD_BUS_NAME ".Service"
+
+static GDBusConnection *systemd_bus = NULL;
+static gboolean systemd_checked = FALSE;
+
+/* Job object path -> action waiting for it */
+static GHashTable *systemd_jobs = NULL;
+
+/*
+ * Job object path -> result, for jobs that were removed before the reply
+ * to the request that queued them was handled.  Only kept while such
+ * requests are outstanding.
+ */
+static GHashTable *systemd_early_results = NULL;
+static unsigned int systemd_jobs_requested = 0;
+
+typedef struct systemd_wait_s {
+    const char *job;
+    char       *result;
+    gboolean    timed_out;
+} systemd_wait_t;
+
+static char *
+systemd_unit_name(const char *agent)
+{
+    if (strchr(agent, '.')) {
+        return g_strdup(agent);
+    }
+    return g_strdup_printf("%s.service", agent);
+}
+
+static const char *
+systemd_job_method(svc_action_t *op)
+{
+    if (strcmp(op->action, "start") == 0) {
+        return "StartUnit";
+    } else if (strcmp(op->action, "stop") == 0) {
+        return "StopUnit";
+    } else if (strcmp(op->action, "restart") == 0) {
+        return "RestartUnit";
+    } else if (strcmp(op->action, "reload") == 0) {
+        return "ReloadUnit";
+    }
+    return NULL;
+}
+
+/**
+ * \internal
+ * \brief Whether an action reports LSB status codes
+ *
+ * Like the systemctl fallback and LSB init scripts, "status" answers with
+ * LSB_STATUS_* codes.  Only "monitor" uses OCF codes.
+ */
+static gboolean
+systemd_is_status(svc_action_t *op)
+{
+    return op->action && strcmp(op->action, "status") == 0;
+}
+
+static void
+systemd_set_error(svc_action_t *op, GError *error)
+{
+    mh_err("%s failed: %s", op->id, error->message);
+
+    op->status = LRM_OP_ERROR;
+    if (g_dbus_error_is_remote_error(error)) {
+        char *name = g_dbus_error_get_remote_error(error);
+
+        if (strcmp(name, SYSTEMD_BUS_NAME ".NoSuchUnit") == 0
+            || strcmp(name, SYSTEMD_BUS_NAME ".LoadFailed") == 0) {
+            op->status = LRM_OP_DONE;
+            op->rc = systemd_is_status(op) ? LSB_STATUS_NOT_INSTALLED
+                                           : OCF_NOT_INSTALLED;
+        } else {
+            op->rc = OCF_UNKNOWN_ERROR;
+        }
+        g_free(name);
+
+    } else {
+        op->rc = OCF_UNKNOWN_ERROR;
+    }
+}
+
+static void
+systemd_set_job_result(svc_action_t *op, const char *result)
+{
+    mh_debug("%s: job completed with result '%s'", op->id, result);
+
+    op->status = LRM_OP_DONE;
+    if (strcmp(result, "done") == 0) {
+        op->rc = OCF_OK;
+    } else if (strcmp(result, "timeout") == 0) {
+        op->status = LRM_OP_TIMEOUT;
+        op->rc = OCF_TIMEOUT;
+    } else {
+        op->rc = OCF_UNKNOWN_ERROR;
+    }
+}
+
+static void
+systemd_set_unit_state(svc_action_t *op, GVariant *properties)
+{
+    const char *load_state = NULL;
+    const char *active_state = NULL;
+    gboolean status = systemd_is_status(op);
+
+    g_variant_lookup(properties, "LoadState", "&s", &load_state);
+    g_variant_lookup(properties, "ActiveState", "&s", &active_state);
+
+    mh_debug("%s: LoadState=%s ActiveState=%s", op->id,
+             load_state ? load_state : "(null)",
+             active_state ? active_state : "(null)");
+
+    op->status = LRM_OP_DONE;
+    if (load_state && strcmp(load_state, "not-found") == 0) {
+        op->rc = status ? LSB_STATUS_NOT_INSTALLED : OCF_NOT_INSTALLED;
+    } else if (active_state == NULL) {
+        op->status = LRM_OP_ERROR;
+        op->rc = status ? LSB_STATUS_OTHER_ERROR : OCF_UNKNOWN_ERROR;
+    } else if (strcmp(active_state, "active") == 0
+               || strcmp(active_state, "reloading") == 0) {
+        op->rc = status ? LSB_STATUS_OK : OCF_OK;
+    } else if (strcmp(active_state, "activating") == 0
+               || strcmp(active_state, "deactivating") == 0) {
+        op->rc = status ? LSB_STATUS_PENDING : OCF_PENDING;
+    } else {
+        op->rc = status ? LSB_STATUS_NOT_RUNNING : OCF_NOT_RUNNING;
+    }
+}
+
+static gboolean
+systemd_parse_job_removed(GVariant *parameters, const char **job,
+                          const char **result)
+{
+    guint32 id;
+    const char *unit;
+
+    if (g_variant_is_of_type(parameters, G_VARIANT_TYPE("(uoss)"))) {
+        g_variant_get(parameters, "(u&o&s&s)", &id, job, &unit, result);
+        return TRUE;
+
+    } else if (g_variant_is_of_type(parameters, G_VARIANT_TYPE("(uos)"))) {
+        /* systemd before v44 did not include the unit name */
+        g_variant_get(parameters, "(u&o&s)", &id, job, result);
+        return TRUE;
+    }
+
+    return FALSE;
+}
+
+static void
+systemd_job_forget(svc_action_t *op)
+{
+    if (op->opaque->job_timer) {
+        g_source_remove(op->opaque->job_timer);
+        op->opaque->job_timer = 0;
+    }
+
+    if (op->opaque->job) {
+        g_hash_table_remove(systemd_jobs, op->opaque->job);
+        g_free(op->opaque->job);
+        op->opaque->job = NULL;
+    }
+}
+
+static void
+systemd_job_removed(GDBusConnection *connection, const gchar *sender,
+                    const gchar *path, const gchar *iface,
+                    const gchar *signal, GVariant *parameters,
+                    gpointer user_data)
+{
+    const char *job = NULL;
+    const char *result = NULL;
+    svc_action_t *op = NULL;
+
+    if (!systemd_parse_job_removed(parameters, &job, &result)) {
+        return;
+    }
+
+    if ((op = g_hash_table_lookup(systemd_jobs, job)) == NULL) {
+        if (systemd_jobs_requested) {
+            /* Possibly ours, with the reply naming it still to come */
+            g_hash_table_replace(systemd_early_results, g_strdup(job),
+                                 g_strdup(result));
+        }
+        return;
+    }
+
+    systemd_job_forget(op);
+    systemd_set_job_result(op, result);
+    services_action_finalize(op);
+}
+
+static gboolean
+systemd_job_timeout(gpointer user_data)
+{
+    svc_action_t *op = user_data;
+
+    mh_warn("%s - timed out after %dms, cancelling job %s", op->id,
+            op->timeout, op->opaque->job);
+
+    g_dbus_connection_call(systemd_bus, SYSTEMD_BUS_NAME, op->opaque->job,
+                           SYSTEMD_JOB_IFACE, "Cancel", NULL, NULL,
+                           G_DBUS_CALL_FLAGS_NONE, -1, NULL, NULL, NULL);
+
+    op->opaque->job_timer = 0;
+    systemd_job_forget(op);
+
+    op->status = LRM_OP_TIMEOUT;
+    op->rc = OCF_TIMEOUT;
+    services_action_finalize(op);
+
+    return FALSE;
+}
+
+static void
+systemd_job_queued(GObject *source, GAsyncResult *res, gpointer user_data)
+{
+    GError *error = NULL;
+    GVariant *reply = NULL;
+    const char *result = NULL;
+    svc_action_t *op = user_data;
+
+    reply = g_dbus_connection_call_finish(G_DBUS_CONNECTION(source), res,
+                                          &error);
+    systemd_jobs_requested--;
+
+    if (reply == NULL) {
+        systemd_set_error(op, error);
+        g_error_free(error);
+        services_action_finalize(op);
+        goto done;
+    }
+
+    g_variant_get(reply, "(o)", &op->opaque->job);
+    g_variant_unref(reply);
+
+    result = g_hash_table_lookup(systemd_early_results, op->opaque->job);
+    if (result) {
+        mh_trace("%s: job %s already completed", op->id, op->opaque->job);
+        systemd_set_job_result(op, result);
+        g_hash_table_remove(systemd_early_results, op->opaque->job);
+        g_free(op->opaque->job);
+        op->opaque->job = NULL;
+        services_action_finalize(op);
+        goto done;
+    }
+
+    mh_trace("%s: waiting for job %s", op->id, op->opaque->job);
+    g_hash_table_insert(systemd_jobs, op->opaque->job, op);
+
+    if (op->timeout > 0) {
+        op->opaque->job_timer = g_timeout_add(op->timeout,
+                                              systemd_job_timeout, op);
+    }
+
+done:
+    if (systemd_jobs_requested == 0) {
+        g_hash_table_remove_all(systemd_early_results);
+    }
+}
+
+static void
+systemd_unit_loaded(GObject *source, GAsyncResult *res, gpointer user_data);
+
+static void
+systemd_unit_properties(GObject *source, GAsyncResult *res,
+                        gpointer user_data)
+{
+    GError *error = NULL;
+    GVariant *reply = NULL;
+    GVariant *properties = NULL;
+    svc_action_t *op = user_data;
+
+    reply = g_dbus_connection_call_finish(G_DBUS_CONNECTION(source), res,
+                                          &error);
+    if (reply == NULL) {
+        systemd_set_error(op, error);
+        g_error_free(error);
+
+    } else {
+        g_variant_get(reply, "(@a{sv})", &properties);
+        systemd_set_unit_state(op, properties);
+        g_variant_unref(properties);
+        g_variant_unref(reply);
+    }
+
+    services_action_finalize(op);
+}
+
+static void
+systemd_unit_loaded(GObject *source, GAsyncResult *res, gpointer user_data)
+{
+    GError *error = NULL;
+    GVariant *reply = NULL;
+    const char *unit = NULL;
+    svc_action_t *op = user_data;
+
+    reply = g_dbus_connection_call_finish(G_DBUS_CONNECTION(source), res,
+                                          &error);
+    if (reply == NULL) {
+        systemd_set_error(op, error);
+        g_error_free(error);
+        services_action_finalize(op);
+        return;
+    }
+
+    g_variant_get(reply, "(&o)", &unit);
+    g_dbus_connection_call(systemd_bus, SYSTEMD_BUS_NAME, unit,
+                           "org.freedesktop.DBus.Properties", "GetAll",
+                           g_variant_new("(s)", SYSTEMD_UNIT_IFACE),
+                           G_VARIANT_TYPE("(a{sv})"), G_DBUS_CALL_FLAGS_NONE,
+                           op->timeout > 0 ? op->timeout : -1, NULL,
+                           systemd_unit_properties, op);
+    g_variant_unref(reply);
+}
+
+static void
+systemd_wait_removed(GDBusConnection *connection, const gchar *sender,
+                     const gchar *path, const gchar *iface,
+                     const gchar *signal, GVariant *parameters,
+                     gpointer user_data)
+{
+    const char *job = NULL;
+    const char *result = NULL;
+    systemd_wait_t *wait = user_data;
+
+    if (wait->result == NULL && wait->job
+        && systemd_parse_job_removed(parameters, &job, &result)
+        && strcmp(job, wait->job) == 0) {
+        wait->result = g_strdup(result);
+    }
+}
+
+static gboolean
+systemd_wait_timeout(gpointer user_data)
+{
+    ((systemd_wait_t *) user_data)->timed_out = TRUE;
+    return FALSE;
+}
+
+/**
+ * \internal
+ * \brief Queue a job and wait for it to complete
+ *
+ * Job signals are subscribed to from a private main context, so waiting for
+ * them does not dispatch anything else the process has attached to the
+ * default context.
+ */
+static void
+systemd_job_sync(svc_action_t *op, const char *method, const char *unit)
+{
+    guint subscription;
+    GSource *timer = NULL;
+    GError *error = NULL;
+    GVariant *reply = NULL;
+    char *job = NULL;
+    systemd_wait_t wait = { NULL, NULL, FALSE };
+    GMainContext *ctx = g_main_context_new();
+
+    g_main_context_push_thread_default(ctx);
+    subscription = g_dbus_connection_signal_subscribe(systemd_bus,
+            SYSTEMD_BUS_NAME, SYSTEMD_MANAGER_IFACE, "JobRemoved",
+            SYSTEMD_OBJECT_PATH, NULL, G_DBUS_SIGNAL_FLAGS_NONE,
+            systemd_wait_removed, &wait, NULL);
+    g_main_context_pop_thread_default(ctx);
+
+    reply = g_dbus_connection_call_sync(systemd_bus, SYSTEMD_BUS_NAME,
+                                        SYSTEMD_OBJECT_PATH,
+                                        SYSTEMD_MANAGER_IFACE, method,
+                                        g_variant_new("(ss)", unit, "replace"),
+                                        G_VARIANT_TYPE("(o)"),
+                                        G_DBUS_CALL_FLAGS_NONE, -1, NULL,
+                                        &error);
+    if (reply == NULL) {
+        systemd_set_error(op, error);
+        g_error_free(error);
+        goto done;
+    }
+
+    g_variant_get(reply, "(o)", &job);
+    g_variant_unref(reply);
+    wait.job = job;
+
+    if (op->timeout > 0) {
+        timer = g_timeout_source_new(op->timeout);
+        g_source_set_callback(timer, systemd_wait_timeout, &wait, NULL);
+        g_source_attach(timer, ctx);
+    }
+
+    while (wait.result == NULL && !wait.timed_out) {
+        g_main_context_iteration(ctx, TRUE);
+    }
+
+    if (wait.result) {
+        systemd_set_job_result(op, wait.result);
+
+    } else {
+        mh_warn("%s - timed out after %dms, cancelling job %s", op->id,
+                op->timeout, job);
+        g_dbus_connection_call(systemd_bus, SYSTEMD_BUS_NAME, job,
+                               SYSTEMD_JOB_IFACE, "Cancel", NULL, NULL,
+                               G_DBUS_CALL_FLAGS_NONE, -1, NULL, NULL, NULL);
+        op->status = LRM_OP_TIMEOUT;
+        op->rc = OCF_TIMEOUT;
+    }
+
+done:
+    if (timer) {
+        g_source_destroy(timer);
+        g_source_unref(timer);
+    }
+    g_dbus_connection_signal_unsubscribe(systemd_bus, subscription);
+    g_main_context_unref(ctx);
+    g_free(wait.result);
+    g_free(job);
+}
+
+static void
+systemd_status_sync(svc_action_t *op, const char *unit)
+{
+    GError *error = NULL;
+    GVariant *reply = NULL;
+    GVariant *properties = NULL;
+    const char *path = NULL;
+
+    reply = g_dbus_connection_call_sync(systemd_bus, SYSTEMD_BUS_NAME,
+                                        SYSTEMD_OBJECT_PATH,
+                                        SYSTEMD_MANAGER_IFACE, "LoadUnit",
+                                        g_variant_new("(s)", unit),
+                                        G_VARIANT_TYPE("(o)"),
+                                        G_DBUS_CALL_FLAGS_NONE, -1, NULL,
+                                        &error);
+    if (reply == NULL) {
+        systemd_set_error(op, error);
+        g_error_free(error);
+        return;
+    }
+
+    g_variant_get(reply, "(&o)", &path);
+    properties = g_dbus_connection_call_sync(systemd_bus, SYSTEMD_BUS_NAME,
+                                             path,
+                                             "org.freedesktop.DBus.Properties",
+                                             "GetAll",
+                                             g_variant_new("(s)",
+                                                           SYSTEMD_UNIT_IFACE),
+                                             G_VARIANT_TYPE("(a{sv})"),
+                                             G_DBUS_CALL_FLAGS_NONE, -1, NULL,
+                                             &error);
+    g_variant_unref(reply);
+
+    if (properties == NULL) {
+        systemd_set_error(op, error);
+        g_error_free(error);
+        return;
+    }
+
+    reply = g_variant_get_child_value(properties, 0);
+    systemd_set_unit_state(op, reply);
+    g_variant_unref(reply);
+    g_variant_unref(properties);
+}
+
+static GDBusConnection *
+systemd_connect(void)
+{
+    GError *error = NULL;
+    GVariant *reply = NULL;
+
+    if (systemd_checked) {
+        return systemd_bus;
+    }
+    systemd_checked = TRUE;
+
+#if !GLIB_CHECK_VERSION(2, 35, 0)
+    g_type_init();
+#endif
+
+    systemd_bus = g_bus_get_sync(G_BUS_TYPE_SYSTEM, NULL, &error);
+    if (systemd_bus == NULL) {
+        mh_info("Could not connect to the system bus, using %s: %s",
+                SYSTEMCTL, error->message);
+        g_error_free(error);
+        return NULL;
+    }
+
+    /* Job signals are only emitted to subscribed clients */
+    reply = g_dbus_connection_call_sync(systemd_bus, SYSTEMD_BUS_NAME,
+                                        SYSTEMD_OBJECT_PATH,
+                                        SYSTEMD_MANAGER_IFACE, "Subscribe",
+                                        NULL, NULL, G_DBUS_CALL_FLAGS_NONE,
+                                        -1, NULL, &error);
+    if (reply == NULL) {
+        mh_info("systemd is not available over D-Bus, using %s: %s",
+                SYSTEMCTL, error->message);
+        g_error_free(error);
+        g_object_unref(systemd_bus);
+        systemd_bus = NULL;
+        return NULL;
+    }
+    g_variant_unref(reply);
+
+    systemd_jobs = g_hash_table_new(g_str_hash, g_str_equal);
+    systemd_early_results = g_hash_table_new_full(g_str_hash, g_str_equal,
+                                                  g_free, g_free);
+    g_dbus_connection_signal_subscribe(systemd_bus, SYSTEMD_BUS_NAME,
+                                       SYSTEMD_MANAGER_IFACE, "JobRemoved",
+                                       SYSTEMD_OBJECT_PATH, NULL,
+                                       G_DBUS_SIGNAL_FLAGS_NONE,
+                                       systemd_job_removed, NULL, NULL);
+    return systemd_bus;
+}
+
+gboolean
+systemd_unit_exec(svc_action_t *op, gboolean synchronous)
+{
+    char *unit = NULL;
+    const char *method = NULL;
+    gboolean status = FALSE;
+
+    if (strcmp(op->action, "status") == 0
+        || strcmp(op->action, "monitor") == 0) {
+        status = TRUE;
+    } else if ((method = systemd_job_method(op)) == NULL) {
+        /* enable, disable, etc. are still handled by systemctl */
+        return FALSE;
+    }
+
+    if (systemd_connect() == NULL) {
+        return FALSE;
+    }
+
+    unit = systemd_unit_name(op->agent);
+    op->pid = 0;
+
+    if (synchronous && status) {
+        systemd_status_sync(op, unit);
+
+    } else if (synchronous) {
+        systemd_job_sync(op, method, unit);
+
+    } else if (status) {
+        g_dbus_connection_call(systemd_bus, SYSTEMD_BUS_NAME,
+                               SYSTEMD_OBJECT_PATH, SYSTEMD_MANAGER_IFACE,
+                               "LoadUnit", g_variant_new("(s)", unit),
+                               G_VARIANT_TYPE("(o)"), G_DBUS_CALL_FLAGS_NONE,
+                               op->timeout > 0 ? op->timeout : -1, NULL,
+                               systemd_unit_loaded, op);
+
+    } else {
+        systemd_jobs_requested++;
+        g_dbus_connection_call(systemd_bus, SYSTEMD_BUS_NAME,
+                               SYSTEMD_OBJECT_PATH, SYSTEMD_MANAGER_IFACE,
+                               method, g_variant_new("(ss)", unit, "replace"),
+                               G_VARIANT_TYPE("(o)"), G_DBUS_CALL_FLAGS_NONE,
+                               -1, NULL, systemd_job_queued, op);
+    }
+
+    g_free(unit);
+    return TRUE;
+}
+
+gboolean
+systemd_unit_list(GList **units)
+{
+    GError *error = NULL;
+    GVariant *reply = NULL;
+    GVariant *list = NULL;
+    GVariantIter iter;
+    const char *name = NULL;
+
+    if (systemd_connect() == NULL) {
+        return FALSE;
+    }
+
+    reply = g_dbus_connection_call_sync(systemd_bus, SYSTEMD_BUS_NAME,
+                                        SYSTEMD_OBJECT_PATH,
+                                        SYSTEMD_MANAGER_IFACE, "ListUnits",
+                                        NULL, NULL, G_DBUS_CALL_FLAGS_NONE,
+                                        -1, NULL, &error);
+    if (reply == NULL) {
+        mh_err("Could not list systemd units: %s", error->message);
+        g_error_free(error);
+        return FALSE;
+    }
+
+    list = g_variant_get_child_value(reply, 0);
+    g_variant_iter_init(&iter, list);
+    /* (name, description, load, active, sub, following, path, job id,
+     *  job type, job path) */
+    while (g_variant_iter_next(&iter, "(&s&s&s&s&s&s&ou&s&o)", &name,
+                               NULL, NULL, NULL, NULL, NULL, NULL, NULL,
+                               NULL, NULL)) {
+        const char *end = g_str_has_suffix(name, ".service")
+                          ? name + strlen(name) - strlen(".service") : NULL;
+
+        if (end) {
+            *units = g_list_append(*units, strndup(name, end - name));
+        }
+    }
+
+    g_variant_unref(list);
+    g_variant_unref(reply);
+    return TRUE;
+}
+
+pid_t
+systemd_unit_main_pid(const char *agent)
+{
+    GError *error = NULL;
+    GVariant *reply = NULL;
+    GVariant *property = NULL;
+    GVariant *value = NULL;
+    const char *path = NULL;
+    char *unit = NULL;
+    pid_t pid = 0;
+
+    if (systemd_connect() == NULL) {
+        return 0;
+    }
+
+    /* Only loaded units can be running, so there is no need to load it */
+    unit = systemd_unit_name(agent);
+    reply = g_dbus_connection_call_sync(systemd_bus, SYSTEMD_BUS_NAME,
+                                        SYSTEMD_OBJECT_PATH,
+                                        SYSTEMD_MANAGER_IFACE, "GetUnit",
+                                        g_variant_new("(s)", unit),
+                                        G_VARIANT_TYPE("(o)"),
+                                        G_DBUS_CALL_FLAGS_NONE, -1, NULL,
+                                        &error);
+    if (reply == NULL) {
+        mh_debug("Could not get unit %s: %s", unit, error->message);
+        g_error_free(error);
+        goto done;
+    }
+
+    g_variant_get(reply, "(&o)", &path);
+    property = g_dbus_connection_call_sync(systemd_bus, SYSTEMD_BUS_NAME,
+                                           path,
+                                           "org.freedesktop.DBus.Properties",
+                                           "Get",
+                                           g_variant_new("(ss)",
+                                                         SYSTEMD_SERVICE_IFACE,
+                                                         "MainPID"),
+                                           G_VARIANT_TYPE("(v)"),
+                                           G_DBUS_CALL_FLAGS_NONE, -1, NULL,
+                                           &error);
+    if (property == NULL) {
+        mh_debug("Could not get the main pid of %s: %s", unit,
+                 error->message);
+        g_error_free(error);
+        goto done;
+    }
+
+    g_variant_get(property, "(v)", &value);
+    if (g_variant_is_of_type(value, G_VARIANT_TYPE_UINT32)) {
+        pid = g_variant_get_uint32(value);
+    }
+    g_variant_unref(value);
+    g_variant_unref(property);
+
+done:
+    if (reply) {
+        g_variant_unref(reply);
+    }
+    g_free(unit);
+    return pid;
+}
+
+#else /* HAVE_GDBUS */
+
+gboolean
+systemd_unit_exec(svc_action_t *op, gboolean synchronous)
+{
+    return FALSE;
+}
+
+gboolean
+systemd_unit_list(GList **units)
+{
+    return FALSE;
+}
+
+pid_t
+systemd_unit_main_pid(const char *agent)
+{
+    return 0;
+}
+
+#endif /* HAVE_GDBUS */
@@ -358,3 +358,19 @@ resources_os_list_ocf_agents(const char *provider)
     /* Unsupported on Windows, return an empty list */
     return NULL;
 }
+
+pid_t
+services_os_watch(const char *name,
+                  void (*callback)(const char *name, pid_t pid,
+                                   void *user_data),
+                  void *user_data)
+{
+    /* Unsupported on Windows */
+    return 0;
+}
+
+gboolean
+services_os_unwatch(const char *name)
+{
+    return FALSE;
+}
@@ -37,8 +37,10 @@ MH_TRACE_INIT_DATA(mh_sysconfig);
 
 #ifdef WIN32
 static const char DEFAULT_KEYS_DIR[] = "c:\\";
+static const char DEFAULT_CACHE_DIR[] = "c:\\";
 #else
 static const char DEFAULT_KEYS_DIR[] = "/var/lib/matahari/sysconfig-keys/";
+static const char DEFAULT_CACHE_DIR[] = "/var/lib/matahari/sysconfig-cache/";
 #endif
 
 /*!
@@ -64,6 +66,29 @@ mh_sysconfig_keys_dir_set(const char *path)
     mh_string_copy(_keys_dir, path, sizeof(_keys_dir));
 }
 
+/*!
+ * Directory to cache downloaded configuration in
+ *
+ * Set with mh_sysconfig_cache_dir_set(), get with sysconfig_cache_dir_get().
+ */
+static char _cache_dir[PATH_MAX];
+
+const char *
+sysconfig_cache_dir_get(void)
+{
+    if (!*_cache_dir) {
+        mh_string_copy(_cache_dir, DEFAULT_CACHE_DIR, sizeof(_cache_dir));
+    }
+
+    return _cache_dir;
+}
+
+void
+mh_sysconfig_cache_dir_set(const char *path)
+{
+    mh_string_copy(_cache_dir, path, sizeof(_cache_dir));
+}
+
 /**
  * \internal
  * \brief Chcek sanity of a key
@@ -182,3 +207,23 @@ mh_sysconfig_query(const char *query, uint32_t flags, const char *scheme)
 {
     return sysconfig_os_query(query, flags, scheme);
 }
+
+enum mh_result
+mh_sysconfig_query_batch(GList *queries, uint32_t flags, const char *scheme,
+                         GHashTable **values)
+{
+    *values = NULL;
+    return sysconfig_os_query_batch(queries, flags, scheme, values);
+}
+
+enum mh_result
+mh_sysconfig_match(const char *pattern, uint32_t flags, const char *scheme,
+                   GHashTable **values)
+{
+    *values = NULL;
+    if (mh_strlen_zero(pattern)) {
+        return MH_RES_INVALID_ARGS;
+    }
+
+    return sysconfig_os_match(pattern, flags, scheme, values);
+}
@@ -22,7 +22,11 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <stddef.h>
+#include <string.h>
 #include <unistd.h>
+#include <errno.h>
+#include <fnmatch.h>
+#include <sys/stat.h>
 #include <glib.h>
 #include <curl/curl.h>
 
@@ -57,62 +61,647 @@ action_data_free(struct action_data *action_data)
 
 /**
  * \internal
- * \note This function is not thread-safe.
+ * \brief Validators and content of a cached download
+ *
+ * The content is stored once per distinct body, named after its SHA-256, so
+ * that URIs serving the same file share it.  Each URI has an index entry
+ * (a key file named after the SHA-256 of the URI) recording the validators
+ * the server sent and the content they apply to.
+ */
+struct download_cache {
+    char *index_file;
+    char *etag;
+    char *last_modified;
+    char *object;
+};
+
+static void
+download_cache_free(struct download_cache *cache)
+{
+    g_free(cache->index_file);
+    g_free(cache->etag);
+    g_free(cache->last_modified);
+    g_free(cache->object);
+}
+
+static gboolean
+download_cacheable(const char *uri)
+{
+    return !strncasecmp(uri, "http://", 7) || !strncasecmp(uri, "https://", 8);
+}
+
+static char *
+download_cache_path(const char *name)
+{
+    return g_strdup_printf("%s%s", sysconfig_cache_dir_get(), name);
+}
+
+/**
+ * \internal
+ * \brief Look up the index entry of a URI
+ *
+ * Validators are only loaded if the content they refer to is still present,
+ * so a damaged cache results in an unconditional download.
+ */
+static void
+download_cache_load(const char *uri, struct download_cache *cache)
+{
+    GKeyFile *index = g_key_file_new();
+    char *hash = g_compute_checksum_for_string(G_CHECKSUM_SHA256, uri, -1);
+    char *name = g_strdup_printf("uri-%s", hash);
+    char *object_file = NULL;
+
+    memset(cache, 0, sizeof(*cache));
+    cache->index_file = download_cache_path(name);
+
+    if (g_key_file_load_from_file(index, cache->index_file, G_KEY_FILE_NONE,
+                                  NULL)) {
+        cache->object = g_key_file_get_string(index, "download", "object", NULL);
+    }
+
+    if (cache->object) {
+        object_file = download_cache_path(cache->object);
+    }
+
+    if (object_file && g_file_test(object_file, G_FILE_TEST_IS_REGULAR)) {
+        cache->etag = g_key_file_get_string(index, "download", "etag", NULL);
+        cache->last_modified = g_key_file_get_string(index, "download",
+                                                     "last_modified", NULL);
+    } else {
+        g_free(cache->object);
+        cache->object = NULL;
+    }
+
+    g_free(object_file);
+    g_free(name);
+    g_free(hash);
+    g_key_file_free(index);
+}
+
+/**
+ * \internal
+ * \brief Remove cached content once no index entry refers to it any more
+ */
+static void
+download_cache_release(const char *object)
+{
+    GDir *dir = NULL;
+    const char *name = NULL;
+    char *object_file = NULL;
+
+    if (!object || !(dir = g_dir_open(sysconfig_cache_dir_get(), 0, NULL))) {
+        return;
+    }
+
+    while ((name = g_dir_read_name(dir))) {
+        GKeyFile *index = NULL;
+        char *index_file = NULL;
+        char *other = NULL;
+
+        if (strncmp(name, "uri-", 4)) {
+            continue;
+        }
+
+        index = g_key_file_new();
+        index_file = download_cache_path(name);
+        if (g_key_file_load_from_file(index, index_file, G_KEY_FILE_NONE,
+                                      NULL)) {
+            other = g_key_file_get_string(index, "download", "object", NULL);
+        }
+        g_key_file_free(index);
+        g_free(index_file);
+
+        if (other && !strcmp(other, object)) {
+            /* Still shared with another URI */
+            g_free(other);
+            g_dir_close(dir);
+            return;
+        }
+        g_free(other);
+    }
+    g_dir_close(dir);
+
+    object_file = download_cache_path(object);
+    if (unlink(object_file) < 0 && errno != ENOENT) {
+        mh_perror(LOG_WARNING, "Could not remove cached download %s",
+                  object_file);
+    }
+    g_free(object_file);
+}
+
+/**
+ * \internal
+ * \brief Store downloaded content along with the validators it came with
+ *
+ * The content previously stored for the URI is removed if nothing else
+ * refers to it, so the cache does not grow with every change to a file.
+ */
+static void
+download_cache_store(const char *uri, struct download_cache *cache,
+                     const GString *body)
+{
+    GKeyFile *index = NULL;
+    char *old_object = cache->object;
+    char *object_file = NULL;
+    char *data = NULL;
+    gsize length = 0;
+
+    cache->object = NULL;
+
+    if (!cache->etag && !cache->last_modified) {
+        /* Nothing to revalidate with, so it could never be used */
+        if (old_object && unlink(cache->index_file) == 0) {
+            download_cache_release(old_object);
+        }
+        g_free(old_object);
+        return;
+    }
+
+    if (!g_file_test(sysconfig_cache_dir_get(), G_FILE_TEST_IS_DIR)
+        && g_mkdir(sysconfig_cache_dir_get(), 0700) < 0) {
+        mh_warn("Could not create cache directory %s",
+                sysconfig_cache_dir_get());
+        g_free(old_object);
+        return;
+    }
+
+    cache->object = g_compute_checksum_for_data(G_CHECKSUM_SHA256,
+                                                (const guchar *) body->str,
+                                                body->len);
+    object_file = download_cache_path(cache->object);
+
+    if (!g_file_test(object_file, G_FILE_TEST_IS_REGULAR)
+        && !g_file_set_contents(object_file, body->str, body->len, NULL)) {
+        mh_warn("Could not cache the contents of %s", uri);
+        goto done;
+    }
+
+    index = g_key_file_new();
+    g_key_file_set_string(index, "download", "uri", uri);
+    g_key_file_set_string(index, "download", "object", cache->object);
+    if (cache->etag) {
+        g_key_file_set_string(index, "download", "etag", cache->etag);
+    }
+    if (cache->last_modified) {
+        g_key_file_set_string(index, "download", "last_modified",
+                              cache->last_modified);
+    }
+
+    data = g_key_file_to_data(index, &length, NULL);
+    if (!g_file_set_contents(cache->index_file, data, length, NULL)) {
+        mh_warn("Could not update cache index %s", cache->index_file);
+    } else if (old_object && strcmp(old_object, cache->object)) {
+        download_cache_release(old_object);
+    }
+
+done:
+    g_free(old_object);
+    g_free(data);
+    g_free(object_file);
+    if (index) {
+        g_key_file_free(index);
+    }
+}
+
+/**
+ * \internal
+ * \brief Read cached content for a URI that has not changed
  */
 static enum mh_result
-sysconfig_os_download(const char *uri, FILE *fp)
+download_cache_read(struct download_cache *cache, GString *body)
 {
+    char *object_file = download_cache_path(cache->object);
+    char *contents = NULL;
+    gsize length = 0;
+
+    if (!g_file_get_contents(object_file, &contents, &length, NULL)) {
+        mh_warn("Could not read cached download %s", object_file);
+        g_free(object_file);
+        return MH_RES_DOWNLOAD_ERROR;
+    }
+
+    g_string_truncate(body, 0);
+    g_string_append_len(body, contents, length);
+
+    g_free(contents);
+    g_free(object_file);
+    return MH_RES_SUCCESS;
+}
+
+/**
+ * \internal
+ * \brief A run_uri request waiting for its configuration to be downloaded
+ */
+struct download {
     CURL *curl;
+    char *uri;
+    GString *body;
+    struct download_cache cache;
+    struct curl_slist *headers;
+    gboolean cacheable;
+
+    char *scheme;
+    char *key;
+    mh_sysconfig_result_cb result_cb;
+    void *cb_data;
+};
+
+/*
+ * Connections are given up on if they cannot be established, or stall, for
+ * this long.  There is no limit on the duration of a download as such.
+ */
+#define DOWNLOAD_CONNECT_TIMEOUT_S 30
+#define DOWNLOAD_STALL_TIMEOUT_S   60
+
+/* Shared by all network downloads, which also share its connection cache */
+static CURLM *downloads = NULL;
+static guint download_timer = 0;
+
+static enum mh_result run_downloaded(struct download *dl);
+
+static void
+download_free(struct download *dl)
+{
+    if (dl->curl) {
+        curl_easy_cleanup(dl->curl);
+    }
+    curl_slist_free_all(dl->headers);
+    download_cache_free(&dl->cache);
+    g_string_free(dl->body, TRUE);
+    free(dl->uri);
+    free(dl->scheme);
+    free(dl->key);
+    free(dl);
+}
+
+static size_t
+download_write_cb(void *ptr, size_t size, size_t nmemb, void *userdata)
+{
+    g_string_append_len((GString *) userdata, ptr, size * nmemb);
+    return size * nmemb;
+}
+
+/**
+ * \internal
+ * \brief Pick the validators out of the response headers
+ */
+static size_t
+download_header_cb(void *ptr, size_t size, size_t nmemb, void *userdata)
+{
+    struct download_cache *cache = userdata;
+    size_t len = size * nmemb;
+    char *line = g_strstrip(g_strndup(ptr, len));
+
+    if (!strncasecmp(line, "HTTP/", 5)) {
+        /* Status line, headers of a new response follow */
+        g_free(cache->etag);
+        g_free(cache->last_modified);
+        cache->etag = cache->last_modified = NULL;
+
+    } else if (!strncasecmp(line, "ETag:", 5)) {
+        g_free(cache->etag);
+        cache->etag = g_strdup(g_strchug(line + 5));
+
+    } else if (!strncasecmp(line, "Last-Modified:", 14)) {
+        g_free(cache->last_modified);
+        cache->last_modified = g_strdup(g_strchug(line + 14));
+    }
+
+    g_free(line);
+    return len;
+}
+
+/**
+ * \internal
+ * \brief Whether a URI is read locally, rather than fetched over the network
+ *
+ * Every other scheme curl accepts (http, ftp, sftp, scp, tftp, ...) may
+ * block on the network, so is downloaded in the background.
+ */
+static gboolean
+download_local(const char *uri)
+{
+    return !strncasecmp(uri, "file:", 5);
+}
+
+/**
+ * \internal
+ * \brief Whether a download's success is told by its response code
+ */
+static gboolean
+download_has_response(const char *uri)
+{
+    return !strncasecmp(uri, "http", 4) || !strncasecmp(uri, "ftp", 3);
+}
+
+/**
+ * \internal
+ * \brief Set up the transfer of a download
+ */
+static enum mh_result
+download_prepare(struct download *dl)
+{
     CURLcode curl_res;
-    long response = 0;
-    enum mh_result res;
 
-    if ((res = mh_curl_init()) != MH_RES_SUCCESS) {
-        return res;
+    if (!(dl->curl = curl_easy_init())) {
+        return MH_RES_OTHER_ERROR;
     }
 
-    if (!(curl = curl_easy_init())) {
+    curl_res = curl_easy_setopt(dl->curl, CURLOPT_URL, dl->uri);
+    if (curl_res != CURLE_OK) {
+        mh_warn("curl_easy_setopt of URI '%s' failed. (%d)", dl->uri, curl_res);
         return MH_RES_OTHER_ERROR;
     }
 
-    curl_res = curl_easy_setopt(curl, CURLOPT_URL, uri);
+    curl_res = curl_easy_setopt(dl->curl, CURLOPT_WRITEFUNCTION,
+                                download_write_cb);
     if (curl_res != CURLE_OK) {
-        mh_warn("curl_easy_setopt of URI '%s' failed. (%d)", uri, curl_res);
-        res = MH_RES_OTHER_ERROR;
-        goto return_cleanup;
+        mh_warn("curl_easy_setopt of WRITEFUNCTION failed. (%d)", curl_res);
+        return MH_RES_OTHER_ERROR;
     }
 
-    curl_res = curl_easy_setopt(curl, CURLOPT_WRITEDATA, fp);
+    curl_res = curl_easy_setopt(dl->curl, CURLOPT_WRITEDATA, dl->body);
     if (curl_res != CURLE_OK) {
-        mh_warn("curl_easy_setopt of WRITEDATA '%p' failed. (%d)", fp, curl_res);
-        res = MH_RES_OTHER_ERROR;
-        goto return_cleanup;
+        mh_warn("curl_easy_setopt of WRITEDATA failed. (%d)", curl_res);
+        return MH_RES_OTHER_ERROR;
+    }
+
+    curl_easy_setopt(dl->curl, CURLOPT_PRIVATE, dl);
+    curl_easy_setopt(dl->curl, CURLOPT_NOSIGNAL, 1L);
+    curl_easy_setopt(dl->curl, CURLOPT_CONNECTTIMEOUT,
+                     (long) DOWNLOAD_CONNECT_TIMEOUT_S);
+    curl_easy_setopt(dl->curl, CURLOPT_LOW_SPEED_LIMIT, 1L);
+    curl_easy_setopt(dl->curl, CURLOPT_LOW_SPEED_TIME,
+                     (long) DOWNLOAD_STALL_TIMEOUT_S);
+
+    if (dl->cacheable) {
+        download_cache_load(dl->uri, &dl->cache);
+
+        if (dl->cache.etag) {
+            char *header = g_strdup_printf("If-None-Match: %s", dl->cache.etag);
+            dl->headers = curl_slist_append(dl->headers, header);
+            g_free(header);
+        }
+        if (dl->cache.last_modified) {
+            char *header = g_strdup_printf("If-Modified-Since: %s",
+                                           dl->cache.last_modified);
+            dl->headers = curl_slist_append(dl->headers, header);
+            g_free(header);
+        }
+
+        curl_easy_setopt(dl->curl, CURLOPT_HTTPHEADER, dl->headers);
+        curl_easy_setopt(dl->curl, CURLOPT_HEADERFUNCTION, download_header_cb);
+        curl_easy_setopt(dl->curl, CURLOPT_HEADERDATA, &dl->cache);
     }
 
-    curl_res = curl_easy_perform(curl);
+    return MH_RES_SUCCESS;
+}
+
+/**
+ * \internal
+ * \brief Check the outcome of a transfer and settle the downloaded content
+ *
+ * On 304 Not Modified the cached content is used, and fresh content is
+ * added to the cache.
+ */
+static enum mh_result
+download_complete(struct download *dl, CURLcode curl_res)
+{
+    long response = 0;
+
     if (curl_res != CURLE_OK) {
-        mh_warn("curl request for URI '%s' failed. (%d)", uri, curl_res);
-        res = MH_RES_DOWNLOAD_ERROR;
-        goto return_cleanup;
+        mh_warn("curl request for URI '%s' failed. (%d) %s", dl->uri, curl_res,
+                curl_easy_strerror(curl_res));
+        return MH_RES_DOWNLOAD_ERROR;
     }
 
-    if (!strncasecmp(uri, "http", 4) || !strncasecmp(uri, "ftp", 3)) {
-        curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &response);
+    if (download_has_response(dl->uri)) {
+        curl_res = curl_easy_getinfo(dl->curl, CURLINFO_RESPONSE_CODE, &response);
         if (curl_res != CURLE_OK) {
             mh_warn("curl_easy_getinfo for RESPONSE_CODE failed. (%d)", curl_res);
-            res = MH_RES_DOWNLOAD_ERROR;
-            goto return_cleanup;
+            return MH_RES_DOWNLOAD_ERROR;
+        }
+
+        if (response == 304 && dl->cacheable && dl->cache.object) {
+            mh_info("%s has not changed, using the cached copy", dl->uri);
+            return download_cache_read(&dl->cache, dl->body);
         }
+
         if (response < 200 || response > 299) {
-            mh_warn("curl request for URI '%s' got response %ld", uri, response);
-            res = MH_RES_DOWNLOAD_ERROR;
+            mh_warn("curl request for URI '%s' got response %ld", dl->uri,
+                    response);
+            return MH_RES_DOWNLOAD_ERROR;
         }
     }
 
-return_cleanup:
-    curl_easy_cleanup(curl);
+    if (dl->cacheable) {
+        download_cache_store(dl->uri, &dl->cache, dl->body);
+    }
 
-    return res;
+    return MH_RES_SUCCESS;
+}
+
+/**
+ * \internal
+ * \brief Continue the requests whose transfers have finished
+ */
+static void
+download_check_done(void)
+{
+    CURLMsg *msg = NULL;
+    int remaining = 0;
+
+    while ((msg = curl_multi_info_read(downloads, &remaining))) {
+        struct download *dl = NULL;
+        enum mh_result res;
+
+        if (msg->msg != CURLMSG_DONE) {
+            continue;
+        }
+
+        curl_easy_getinfo(msg->easy_handle, CURLINFO_PRIVATE, (char **) &dl);
+        curl_multi_remove_handle(downloads, msg->easy_handle);
+
+        res = download_complete(dl, msg->data.result);
+        if (res == MH_RES_SUCCESS) {
+            res = run_downloaded(dl);
+        }
+
+        if (res != MH_RES_SUCCESS) {
+            mh_err("Unable to configure the system from %s: %s", dl->uri,
+                   mh_result_to_str(res));
+            dl->result_cb(dl->cb_data, -res);
+        }
+
+        download_free(dl);
+    }
+}
+
+static gboolean
+download_socket_event(GIOChannel *channel, GIOCondition condition,
+                      gpointer data)
+{
+    int action = 0;
+    int running = 0;
+
+    if (condition & G_IO_IN) {
+        action |= CURL_CSELECT_IN;
+    }
+    if (condition & G_IO_OUT) {
+        action |= CURL_CSELECT_OUT;
+    }
+    if (condition & (G_IO_ERR | G_IO_HUP)) {
+        action |= CURL_CSELECT_ERR;
+    }
+
+    curl_multi_socket_action(downloads, g_io_channel_unix_get_fd(channel),
+                             action, &running);
+    download_check_done();
+
+    /* curl removes the watch itself once it is done with the socket */
+    return TRUE;
+}
+
+static gboolean
+download_timeout(gpointer data)
+{
+    int running = 0;
+
+    download_timer = 0;
+    curl_multi_socket_action(downloads, CURL_SOCKET_TIMEOUT, 0, &running);
+    download_check_done();
+
+    return FALSE;
+}
+
+/**
+ * \internal
+ * \brief Watch the sockets curl asks for in the mainloop
+ *
+ * The id of the watch on a socket is assigned to it with
+ * curl_multi_assign(), so it can be updated or removed later.
+ */
+static int
+download_socket_cb(CURL *curl, curl_socket_t fd, int what, void *userp,
+                   void *socketp)
+{
+    guint *watch = socketp;
+    GIOCondition condition = 0;
+    GIOChannel *channel = NULL;
+
+    if (watch) {
+        g_source_remove(*watch);
+    }
+
+    if (what == CURL_POLL_REMOVE) {
+        curl_multi_assign(downloads, fd, NULL);
+        free(watch);
+        return 0;
+    }
+
+    if (!watch) {
+        watch = calloc(1, sizeof(guint));
+        curl_multi_assign(downloads, fd, watch);
+    }
+
+    if (what & CURL_POLL_IN) {
+        condition |= G_IO_IN;
+    }
+    if (what & CURL_POLL_OUT) {
+        condition |= G_IO_OUT;
+    }
+
+    channel = g_io_channel_unix_new(fd);
+    *watch = g_io_add_watch(channel, condition | G_IO_ERR | G_IO_HUP,
+                            download_socket_event, NULL);
+    g_io_channel_unref(channel);
+
+    return 0;
+}
+
+static int
+download_timer_cb(CURLM *multi, long timeout_ms, void *userp)
+{
+    if (download_timer) {
+        g_source_remove(download_timer);
+        download_timer = 0;
+    }
+
+    /* curl must not be called back into from here, so defer to the mainloop */
+    if (timeout_ms >= 0) {
+        download_timer = g_timeout_add(timeout_ms, download_timeout, NULL);
+    }
+
+    return 0;
+}
+
+/**
+ * \internal
+ * \brief Download the configuration for a run_uri request and apply it
+ *
+ * Network downloads run in the background on the shared multi handle, so
+ * the agent keeps serving other requests, and any number of them proceed
+ * concurrently.  Once a download completes, the configuration is applied
+ * and the result reported through \p result_cb.  If it cannot be, the
+ * callback receives the negated mh_result instead.
+ *
+ * Local files are read, and applied, before this returns.
+ *
+ * HTTP downloads are cached under sysconfig_cache_dir_get() and revalidated
+ * with If-None-Match and If-Modified-Since, so an unchanged file is read
+ * from the cache when the server answers 304 Not Modified.
+ *
+ * \note This function is not thread-safe.
+ */
+static enum mh_result
+sysconfig_os_download(const char *uri, const char *scheme, const char *key,
+                      mh_sysconfig_result_cb result_cb, void *cb_data)
+{
+    struct download *dl = NULL;
+    enum mh_result res;
+
+    if ((res = mh_curl_init()) != MH_RES_SUCCESS) {
+        return res;
+    }
+
+    dl = calloc(1, sizeof(*dl));
+    dl->uri = strdup(uri);
+    dl->body = g_string_new(NULL);
+    dl->cacheable = download_cacheable(uri);
+    dl->scheme = strdup(scheme);
+    dl->key = strdup(key);
+    dl->result_cb = result_cb;
+    dl->cb_data = cb_data;
+
+    if ((res = download_prepare(dl)) != MH_RES_SUCCESS) {
+        download_free(dl);
+        return res;
+    }
+
+    if (download_local(uri)) {
+        res = download_complete(dl, curl_easy_perform(dl->curl));
+        if (res == MH_RES_SUCCESS) {
+            res = run_downloaded(dl);
+        }
+        download_free(dl);
+        return res;
+    }
+
+    if (downloads == NULL) {
+        downloads = curl_multi_init();
+        curl_multi_setopt(downloads, CURLMOPT_SOCKETFUNCTION,
+                          download_socket_cb);
+        curl_multi_setopt(downloads, CURLMOPT_TIMERFUNCTION, download_timer_cb);
+    }
+
+    if (curl_multi_add_handle(downloads, dl->curl) != CURLM_OK) {
+        mh_warn("Could not start downloading %s", uri);
+        download_free(dl);
+        return MH_RES_OTHER_ERROR;
+    }
+
+    mh_debug("Downloading %s", uri);
+    return MH_RES_SUCCESS;
 }
 
 static void
@@ -195,6 +784,51 @@ return_cleanup:
     return res;
 }
 
+/**
+ * \internal
+ * \brief Write configuration to a new temporary file
+ *
+ * \param[in,out] filename a mkstemp() template, replaced by the file's name
+ * \param[in]     data     what to write
+ *
+ * \return MH_RES_SUCCESS, or MH_RES_OTHER_ERROR if the file could not be
+ *         created or written, in which case it does not exist.
+ */
+static enum mh_result
+write_temp_file(char *filename, const char *data)
+{
+    size_t len = strlen(data);
+    size_t done = 0;
+    int fd = mkstemp(filename);
+
+    if (fd < 0) {
+        mh_perror(LOG_ERR, "Unable to create temporary file");
+        return MH_RES_OTHER_ERROR;
+    }
+
+    while (done < len) {
+        ssize_t rc = write(fd, data + done, len - done);
+
+        if (rc < 0 && errno == EINTR) {
+            continue;
+        } else if (rc < 0) {
+            mh_perror(LOG_ERR, "Unable to write temporary file %s", filename);
+            close(fd);
+            unlink(filename);
+            return MH_RES_OTHER_ERROR;
+        }
+        done += rc;
+    }
+
+    if (close(fd) < 0) {
+        mh_perror(LOG_ERR, "Unable to write temporary file %s", filename);
+        unlink(filename);
+        return MH_RES_OTHER_ERROR;
+    }
+
+    return MH_RES_SUCCESS;
+}
+
 static enum mh_result
 run_puppet(const char *uri, int oneoff, const char *data, const char *key,
            mh_sysconfig_result_cb result_cb, void *cb_data)
@@ -222,34 +856,11 @@ run_puppet(const char *uri, int oneoff, const char *data, const char *key,
         if (strstr(domain, "/")) {
             return MH_RES_INVALID_ARGS;
         }
-    } else if (uri) {
-        int fd;
-        FILE *fp;
-
+    } else if (data) {
         snprintf(filename, sizeof(filename), "%s", "puppet_conf_XXXXXX");
-
-        fd = mkstemp(filename);
-        if (fd < 0) {
-            return MH_RES_OTHER_ERROR;
-        }
-
-        fp = fdopen(fd, "w+b");
-        if (fp == NULL) {
-            close(fd);
-            unlink(filename);
-            return MH_RES_OTHER_ERROR;
-        }
-
-        if ((res = sysconfig_os_download(uri, fp)) != 0) {
-            fclose(fp);
-            unlink(filename);
+        if ((res = write_temp_file(filename, data)) != MH_RES_SUCCESS) {
             return res;
         }
-
-        fclose(fp);
-    } else if (data) {
-        snprintf(filename, sizeof(filename), "puppet_conf_%u", g_random_int());
-        g_file_set_contents(filename, data, strlen(data), NULL);
     } else {
         return MH_RES_INVALID_ARGS;
     }
@@ -319,98 +930,45 @@ return_failure:
 }
 
 static enum mh_result
-run_augeas(const char *uri, const char *data, const char *key,
+run_augeas(const char *data, const char *key,
            mh_sysconfig_result_cb result_cb, void *cb_data)
 {
 #ifdef HAVE_AUGEAS
-    int fd;
     FILE *fp;
-    char *text = NULL;
-    char filename[PATH_MAX];
-    GError *err = NULL;
     augeas *aug;
     int result;
     char *value = NULL, *result_str;
-    enum mh_result res = MH_RES_SUCCESS;
-
-    if (uri) {
-        snprintf(filename, sizeof(filename), "%s", "augeas_conf_XXXXXX");
-
-        fd = mkstemp(filename);
-        if (fd < 0) {
-            mh_err("Unable to create temporary file");
-            return MH_RES_OTHER_ERROR;
-        }
-
-        fp = fdopen(fd, "w+b");
-        if (fp == NULL) {
-            close(fd);
-            unlink(filename);
-            mh_err("Unable to open temporary file");
-            return MH_RES_OTHER_ERROR;
-        }
-
-        if ((res = sysconfig_os_download(uri, fp)) != 0) {
-            fclose(fp);
-            unlink(filename);
-            mh_err("Unable to download file from uri %s", uri);
-            return res;
-        }
-
-        fclose(fp);
-
-        if (!g_file_get_contents(filename, &text, NULL, &err)) {
-            mh_err("Unable to read downloaded file: %s", err ? err->message : "Unknown error");
-            unlink(filename);
-            return MH_RES_DOWNLOAD_ERROR;
-        }
-
-        unlink(filename);
+    size_t length = 0;
 
-    } else if (data) {
-        text = g_strdup(data);
-    } else {
-        mh_err("No uri/data provided for augeas");
+    if (!data) {
+        mh_err("No data provided for augeas");
         return MH_RES_INVALID_ARGS;
     }
 
-    snprintf(filename, sizeof(filename), "%s", "augeas_conf_XXXXXX");
-
-    fd = mkstemp(filename);
-    if (fd < 0) {
-        mh_err("Unable to create temporary file");
-        return MH_RES_OTHER_ERROR;
-    }
-
-    fp = fdopen(fd, "w+b");
+    /* aug_srun() output is captured in memory, not in a temporary file */
+    fp = open_memstream(&value, &length);
     if (fp == NULL) {
-        close(fd);
-        unlink(filename);
-        mh_err("Unable to open temporary file");
+        mh_perror(LOG_ERR, "Unable to capture augeas output");
         return MH_RES_OTHER_ERROR;
     }
 
     aug = aug_init("", "", AUG_SAVE_BACKUP);
     if (!aug) {
-        g_free(text);
         fclose(fp);
-        unlink(filename);
+        free(value);
         mh_err("Unable to initialize augeas");
         return MH_RES_BACKEND_ERROR;
     }
 
-    result = aug_srun(aug, fp, text);
+    result = aug_srun(aug, fp, data);
 
-    mh_info("run_augeas for key \"%s\" exited with status %d and data \"%s\"", key, result, text);
+    mh_info("run_augeas for key \"%s\" exited with status %d and data \"%s\"", key, result, data);
 
     aug_close(aug);
 
-    g_free(text);
-    fclose(fp);
-
-    if (!g_file_get_contents(filename, &value, NULL, &err)) {
-        mh_err("Unable to read augeas results: %s", err->message);
-        unlink(filename);
+    if (fclose(fp) != 0) {
+        mh_perror(LOG_ERR, "Unable to read augeas results");
+        free(value);
         return MH_RES_BACKEND_ERROR;
     }
 
@@ -425,7 +983,7 @@ run_augeas(const char *uri, const char *data, const char *key,
     }
 
     free(result_str);
-    unlink(filename);
+    free(value);
 
     return MH_RES_SUCCESS;
 #else /* HAVE_AUGEAS */
@@ -433,23 +991,382 @@ run_augeas(const char *uri, const char *data, const char *key,
 #endif /* HAVE_AUGEAS */
 }
 
+#ifdef HAVE_AUGEAS
+/**
+ * \internal
+ * \brief Where augeas would load a lens, and on which files
+ */
+struct augeas_lens {
+    /* The lens' node under /augeas/load */
+    char *node;
+    /* Glob patterns of the files it applies to, and exceptions */
+    GPtrArray *incl;
+    GPtrArray *excl;
+};
+
+/**
+ * \internal
+ * \brief Long-lived augeas handle for queries
+ *
+ * Loading every lens and parsing every known configuration file takes far
+ * longer than looking up one value, so queries share a handle created with
+ * AUG_NO_LOAD.  Each lens is stripped of its files, and a file is only
+ * added back to its lens (and loaded) once a query needs it.  Loaded files
+ * are reloaded when their mtime changes.
+ */
+static struct {
+    augeas *aug;
+    /* struct augeas_lens * */
+    GPtrArray *lenses;
+    /* Path of each loaded file -> its mtime in ns, as a gint64 * */
+    GHashTable *files;
+} query_session;
+
+static void
+augeas_lens_free(gpointer data)
+{
+    struct augeas_lens *lens = data;
+
+    free(lens->node);
+    g_ptr_array_free(lens->incl, TRUE);
+    g_ptr_array_free(lens->excl, TRUE);
+    free(lens);
+}
+
+static void
+query_session_close(void)
+{
+    if (query_session.aug) {
+        aug_close(query_session.aug);
+        query_session.aug = NULL;
+    }
+    if (query_session.lenses) {
+        g_ptr_array_free(query_session.lenses, TRUE);
+        query_session.lenses = NULL;
+    }
+    if (query_session.files) {
+        g_hash_table_destroy(query_session.files);
+        query_session.files = NULL;
+    }
+}
+
+/**
+ * \internal
+ * \brief Get the values of all nodes matching an augeas path expression
+ */
+static GPtrArray *
+augeas_values(augeas *aug, const char *path)
+{
+    GPtrArray *values = g_ptr_array_new_with_free_func(free);
+    char **matches = NULL;
+    int count = aug_match(aug, path, &matches);
+    int lpc;
+
+    for (lpc = 0; lpc < count; lpc++) {
+        const char *value = NULL;
+
+        if (aug_get(aug, matches[lpc], &value) == 1 && value) {
+            g_ptr_array_add(values, strdup(value));
+        }
+        free(matches[lpc]);
+    }
+    free(matches);
+
+    return values;
+}
+
+static gboolean
+query_session_open(void)
+{
+    char **nodes = NULL;
+    int count;
+    int lpc;
+
+    if (query_session.aug) {
+        return TRUE;
+    }
+
+    query_session.aug = aug_init(NULL, NULL, AUG_NO_LOAD);
+    if (!query_session.aug) {
+        mh_err("Unable to initialize augeas");
+        return FALSE;
+    }
+
+    query_session.lenses = g_ptr_array_new_with_free_func(augeas_lens_free);
+    query_session.files = g_hash_table_new_full(g_str_hash, g_str_equal,
+                                                free, g_free);
+
+    count = aug_match(query_session.aug, "/augeas/load/*", &nodes);
+    for (lpc = 0; lpc < count; lpc++) {
+        struct augeas_lens *lens = calloc(1, sizeof(*lens));
+        char *path = NULL;
+
+        lens->node = nodes[lpc];
+
+        path = g_strdup_printf("%s/incl", lens->node);
+        lens->incl = augeas_values(query_session.aug, path);
+        g_free(path);
+
+        path = g_strdup_printf("%s/excl", lens->node);
+        lens->excl = augeas_values(query_session.aug, path);
+        g_free(path);
+
+        g_ptr_array_add(query_session.lenses, lens);
+    }
+    free(nodes);
+
+    /* Nothing is loaded until a query asks for it */
+    aug_rm(query_session.aug, "/augeas/load/*/incl");
+
+    mh_debug("Started an augeas query session with %d lenses", count);
+    return TRUE;
+}
+
+static gboolean
+augeas_globs_match(GPtrArray *globs, const char *file)
+{
+    unsigned int lpc;
+
+    for (lpc = 0; lpc < globs->len; lpc++) {
+        if (fnmatch(g_ptr_array_index(globs, lpc), file, 0) == 0) {
+            return TRUE;
+        }
+    }
+    return FALSE;
+}
+
+/**
+ * \internal
+ * \brief Find the file holding the node a query refers to
+ *
+ * \return the longest existing regular file that is a prefix of the path
+ *         under /files, or NULL if the query is elsewhere, uses wildcards
+ *         or predicates before reaching a file, or may reach outside the
+ *         file afterwards (a union, a parent step, or another absolute
+ *         /files path, for example inside a predicate)
+ */
+static char *
+augeas_query_file(const char *query)
+{
+    char **parts = NULL;
+    GString *file = NULL;
+    char *result = NULL;
+    int lpc;
+
+    if (strncmp(query, "/files/", 7) != 0) {
+        return NULL;
+    }
+
+    parts = g_strsplit(query + 7, "/", -1);
+    file = g_string_new(NULL);
+
+    for (lpc = 0; parts[lpc] != NULL; lpc++) {
+        if (mh_strlen_zero(parts[lpc]) || strpbrk(parts[lpc], "*[]()'\"|")
+            || strcmp(parts[lpc], "..") == 0) {
+            break;
+        }
+
+        g_string_append_printf(file, "/%s", parts[lpc]);
+        if (g_file_test(file->str, G_FILE_TEST_IS_REGULAR)) {
+            /* What follows the file, within /files */
+            const char *rest = query + 6 + file->len;
+
+            if (strchr(rest, '|') == NULL && strstr(rest, "..") == NULL
+                && strstr(rest, "/files") == NULL) {
+                result = strdup(file->str);
+            }
+            break;
+        }
+    }
+
+    g_string_free(file, TRUE);
+    g_strfreev(parts);
+    return result;
+}
+
+static gint64
+file_mtime_ns(const char *file)
+{
+    struct stat sb;
+
+    if (stat(file, &sb) < 0) {
+        return -1;
+    }
+    return (gint64) sb.st_mtim.tv_sec * 1000000000 + sb.st_mtim.tv_nsec;
+}
+
+/**
+ * \internal
+ * \brief Make sure the current contents of a file are in the session's tree
+ *
+ * \retval TRUE the file is loaded and up to date
+ * \retval FALSE no lens applies to it, or loading it failed
+ */
+static gboolean
+query_session_load(const char *file)
+{
+    gint64 *loaded = g_hash_table_lookup(query_session.files, file);
+    gint64 mtime = file_mtime_ns(file);
+    unsigned int lpc;
+
+    if (loaded && *loaded == mtime) {
+        return TRUE;
+    }
+
+    if (!loaded) {
+        struct augeas_lens *lens = NULL;
+        char *path = NULL;
+
+        for (lpc = 0; lpc < query_session.lenses->len; lpc++) {
+            struct augeas_lens *candidate =
+                g_ptr_array_index(query_session.lenses, lpc);
+
+            if (augeas_globs_match(candidate->incl, file)
+                && !augeas_globs_match(candidate->excl, file)) {
+                lens = candidate;
+                break;
+            }
+        }
+
+        if (lens == NULL) {
+            mh_debug("No augeas lens applies to %s", file);
+            return FALSE;
+        }
+
+        path = g_strdup_printf("%s/incl[last()+1]", lens->node);
+        aug_set(query_session.aug, path, file);
+        g_free(path);
+
+        loaded = g_new(gint64, 1);
+        g_hash_table_insert(query_session.files, strdup(file), loaded);
+    }
+
+    mh_debug("Loading %s into the augeas query session", file);
+    *loaded = mtime;
+
+    if (aug_load(query_session.aug) < 0) {
+        mh_err("Unable to load %s with augeas", file);
+        query_session_close();
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+/**
+ * \internal
+ * \brief Get a tree in which a set of queries can be evaluated
+ *
+ * \param[in]  queries the queries, as (const char *)
+ * \param[out] oneoff  set if the handle returned must be closed by the
+ *                     caller, rather than being the query session's
+ *
+ * \return the handle, or NULL if augeas could not be initialized
+ */
+static augeas *
+query_tree(GList *queries, gboolean *oneoff)
+{
+    gboolean confined = query_session_open();
+    GList *iter = NULL;
+
+    for (iter = queries; confined && iter != NULL; iter = iter->next) {
+        char *file = augeas_query_file(iter->data);
+
+        confined = file && query_session_load(file);
+        free(file);
+    }
+
+    *oneoff = !confined;
+    if (confined) {
+        return query_session.aug;
+    }
+
+    /* Not confined to particular files, so everything has to be loaded */
+    return aug_init("", "", 0);
+}
+
+static enum mh_result
+query_augeas(GList *queries, gboolean match, GHashTable **values)
+{
+    gboolean oneoff = FALSE;
+    augeas *aug = query_tree(queries, &oneoff);
+    GList *iter = NULL;
+
+    if (aug == NULL) {
+        mh_err("Unable to initialize augeas");
+        return MH_RES_BACKEND_ERROR;
+    }
+
+    *values = g_hash_table_new_full(g_str_hash, g_str_equal, free, free);
+
+    for (iter = queries; iter != NULL; iter = iter->next) {
+        const char *value = NULL;
+        char **paths = NULL;
+        int count = 0;
+        int lpc;
+
+        if (!match) {
+            if (aug_get(aug, iter->data, &value) == 1 && value) {
+                g_hash_table_insert(*values, strdup(iter->data), strdup(value));
+            }
+            continue;
+        }
+
+        count = aug_match(aug, iter->data, &paths);
+        for (lpc = 0; lpc < count; lpc++) {
+            value = NULL;
+            aug_get(aug, paths[lpc], &value);
+            /* Keep nodes without a value, they may still be of interest */
+            g_hash_table_insert(*values, paths[lpc],
+                                strdup(value ? value : ""));
+        }
+        free(paths);
+    }
+
+    if (oneoff) {
+        aug_close(aug);
+    }
+    return MH_RES_SUCCESS;
+}
+#endif /* HAVE_AUGEAS */
+
 static char *
 sysconfig_os_query_augeas(const char *query)
 {
 #ifdef HAVE_AUGEAS
     char *data = NULL;
-    const char *value = NULL;
-    augeas *aug = aug_init("", "", 0);
-    aug_get(aug, query, &value);
-    if (value)
-        data = strdup(value);
-    aug_close(aug);
+    GHashTable *values = NULL;
+    GList *queries = g_list_prepend(NULL, (gpointer) query);
+
+    if (query_augeas(queries, FALSE, &values) == MH_RES_SUCCESS) {
+        const char *value = g_hash_table_lookup(values, query);
+
+        if (value)
+            data = strdup(value);
+        g_hash_table_destroy(values);
+    }
+
+    g_list_free(queries);
     return data;
 #else /* HAVE_AUGEAS */
     return NULL;
 #endif /* HAVE_AUGEAS */
 }
 
+/**
+ * \internal
+ * \brief Apply configuration downloaded by sysconfig_os_download()
+ */
+static enum mh_result
+run_downloaded(struct download *dl)
+{
+    if (strcasecmp(dl->scheme, "puppet") == 0) {
+        return run_puppet(NULL, 1, dl->body->str, dl->key, dl->result_cb,
+                          dl->cb_data);
+    }
+    return run_augeas(dl->body->str, dl->key, dl->result_cb, dl->cb_data);
+}
+
 enum mh_result
 sysconfig_os_run_uri(const char *uri, uint32_t flags, const char *scheme,
         const char *key, mh_sysconfig_result_cb result_cb, void *cb_data)
@@ -464,10 +1381,11 @@ sysconfig_os_run_uri(const char *uri, uint32_t flags, const char *scheme,
         return rc;
     }
 
-    if (strcasecmp(scheme, "puppet") == 0) {
+    if (strcasecmp(scheme, "puppet") == 0 && !strncasecmp(uri, "puppet://", 9)) {
         rc = run_puppet(uri, 1, NULL, key, result_cb, cb_data);
-    } else if (strcasecmp(scheme, "augeas") == 0) {
-        rc = run_augeas(uri, NULL, key, result_cb, cb_data);
+    } else if (strcasecmp(scheme, "puppet") == 0
+               || strcasecmp(scheme, "augeas") == 0) {
+        rc = sysconfig_os_download(uri, scheme, key, result_cb, cb_data);
     } else {
         rc = MH_RES_INVALID_ARGS;
     }
@@ -492,7 +1410,7 @@ sysconfig_os_run_string(const char *string, uint32_t flags, const char *scheme,
     if (!strcasecmp(scheme, "puppet")) {
         rc = run_puppet(NULL, 0, string, key, result_cb, cb_data);
     } else if (strcasecmp(scheme, "augeas") == 0) {
-        rc = run_augeas(NULL, string, key, result_cb, cb_data);
+        rc = run_augeas(string, key, result_cb, cb_data);
     } else {
         rc = MH_RES_INVALID_ARGS;
     }
@@ -511,3 +1429,41 @@ sysconfig_os_query(const char *query, uint32_t flags, const char *scheme)
 
     return data;
 }
+
+enum mh_result
+sysconfig_os_query_batch(GList *queries, uint32_t flags, const char *scheme,
+                         GHashTable **values)
+{
+    if (strcasecmp(scheme, "augeas") != 0) {
+        return MH_RES_INVALID_ARGS;
+    }
+
+#ifdef HAVE_AUGEAS
+    return query_augeas(queries, FALSE, values);
+#else /* HAVE_AUGEAS */
+    return MH_RES_NOT_IMPLEMENTED;
+#endif /* HAVE_AUGEAS */
+}
+
+enum mh_result
+sysconfig_os_match(const char *pattern, uint32_t flags, const char *scheme,
+                   GHashTable **values)
+{
+#ifdef HAVE_AUGEAS
+    GList *patterns = NULL;
+    enum mh_result res;
+#endif /* HAVE_AUGEAS */
+
+    if (strcasecmp(scheme, "augeas") != 0) {
+        return MH_RES_INVALID_ARGS;
+    }
+
+#ifdef HAVE_AUGEAS
+    patterns = g_list_prepend(NULL, (gpointer) pattern);
+    res = query_augeas(patterns, TRUE, values);
+    g_list_free(patterns);
+    return res;
+#else /* HAVE_AUGEAS */
+    return MH_RES_NOT_IMPLEMENTED;
+#endif /* HAVE_AUGEAS */
+}
@@ -32,4 +32,21 @@ sysconfig_os_run_string(const char *string, uint32_t flags, const char *scheme,
 char *
 sysconfig_os_query(const char *query, uint32_t flags, const char *scheme);
 
+enum mh_result
+sysconfig_os_query_batch(GList *queries, uint32_t flags, const char *scheme,
+                         GHashTable **values);
+
+enum mh_result
+sysconfig_os_match(const char *pattern, uint32_t flags, const char *scheme,
+                   GHashTable **values);
+
+/**
+ * \internal
+ * \brief Get the directory that downloaded configuration is cached in
+ *
+ * \return the directory, including a trailing separator
+ */
+const char *
+sysconfig_cache_dir_get(void);
+
 #endif /* __MH_SYSCONFIG_PRIVATE_H_ */
@@ -90,3 +90,17 @@ sysconfig_os_query(const char *query, uint32_t flags, const char *scheme)
 {
     return NULL;
 }
+
+enum mh_result
+sysconfig_os_query_batch(GList *queries, uint32_t flags, const char *scheme,
+                         GHashTable **values)
+{
+    return MH_RES_NOT_IMPLEMENTED;
+}
+
+enum mh_result
+sysconfig_os_match(const char *pattern, uint32_t flags, const char *scheme,
+                   GHashTable **values)
+{
+    return MH_RES_NOT_IMPLEMENTED;
+}
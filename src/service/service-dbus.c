@@ -74,24 +74,64 @@ Services_list(Matahari *matahari, DBusGMethodInvocation *context)
     return TRUE;
 }
 
+/* Reply to enable and disable, which only report whether they ran */
+static void
+services_ran_cb(svc_action_t *op)
+{
+    dbus_g_method_return((DBusGMethodInvocation *) op->cb_data, TRUE);
+}
+
+/* Reply to start, stop and status with the action's rc */
+static void
+services_rc_cb(svc_action_t *op)
+{
+    dbus_g_method_return((DBusGMethodInvocation *) op->cb_data, op->rc);
+}
+
+/**
+ * \internal
+ * \brief Run a Services action, replying to the caller once it completes
+ *
+ * The daemon keeps serving other callers while the action executes.
+ */
+static gboolean
+services_action_reply_async(const char *name, const char *action,
+                            unsigned int timeout,
+                            DBusGMethodInvocation *context,
+                            void (*callback)(svc_action_t *op))
+{
+    GError* error = NULL;
+    svc_action_t *op = services_action_create(name, action, 0, timeout);
+
+    if (op != NULL) {
+        op->cb_data = context;
+        if (services_action_async(op, callback)) {
+            return TRUE;
+        }
+        services_action_free(op);
+    }
+
+    mh_err("Could not %s service %s", action, name);
+    error = g_error_new(MATAHARI_ERROR, MH_RES_BACKEND_ERROR,
+                        "Could not %s service %s", action, name);
+    dbus_g_method_return_error(context, error);
+    g_error_free(error);
+    return FALSE;
+}
+
 gboolean
 Services_enable(Matahari *matahari, const char *name,
                 DBusGMethodInvocation *context)
 {
     GError* error = NULL;
-    svc_action_t *op;
-    gboolean res;
 
     if (!check_authorization(SERVICES_BUS_NAME ".enable", &error, context)) {
         dbus_g_method_return_error(context, error);
         g_error_free(error);
         return FALSE;
     }
-    op = services_action_create(name, "enable", 0, TIMEOUT_MS);
-    res = services_action_sync(op);
-    services_action_free(op);
-    dbus_g_method_return(context, res);
-    return res;
+    return services_action_reply_async(name, "enable", TIMEOUT_MS, context,
+                                       services_ran_cb);
 }
 
 gboolean
@@ -99,19 +139,14 @@ Services_disable(Matahari *matahari, const char *name,
                  DBusGMethodInvocation *context)
 {
     GError* error = NULL;
-    svc_action_t *op;
-    gboolean res;
 
     if (!check_authorization(SERVICES_BUS_NAME ".disable", &error, context)) {
         dbus_g_method_return_error(context, error);
         g_error_free(error);
         return FALSE;
     }
-    op = services_action_create(name, "disable", 0, TIMEOUT_MS);
-    res = services_action_sync(op);
-    services_action_free(op);
-    dbus_g_method_return(context, res);
-    return res;
+    return services_action_reply_async(name, "disable", TIMEOUT_MS, context,
+                                       services_ran_cb);
 }
 
 gboolean
@@ -119,20 +154,14 @@ Services_start(Matahari *matahari, const char *name, unsigned int timeout,
                DBusGMethodInvocation *context)
 {
     GError* error = NULL;
-    svc_action_t *op;
-    int rc;
 
     if (!check_authorization(SERVICES_BUS_NAME ".start", &error, context)) {
         dbus_g_method_return_error(context, error);
         g_error_free(error);
         return FALSE;
     }
-    op = services_action_create(name, "start", 0, timeout);
-    services_action_sync(op);
-    rc = op->rc;
-    services_action_free(op);
-    dbus_g_method_return(context, rc);
-    return TRUE;
+    return services_action_reply_async(name, "start", timeout, context,
+                                       services_rc_cb);
 }
 
 gboolean
@@ -140,20 +169,14 @@ Services_stop(Matahari *matahari, const char *name, unsigned int timeout,
               DBusGMethodInvocation *context)
 {
     GError* error = NULL;
-    svc_action_t *op;
-    int rc;
 
     if (!check_authorization(SERVICES_BUS_NAME ".stop", &error, context)) {
         dbus_g_method_return_error(context, error);
         g_error_free(error);
         return FALSE;
     }
-    op = services_action_create(name, "stop", 0, timeout);
-    services_action_sync(op);
-    rc = op->rc;
-    services_action_free(op);
-    dbus_g_method_return(context, rc);
-    return TRUE;
+    return services_action_reply_async(name, "stop", timeout, context,
+                                       services_rc_cb);
 }
 
 gboolean
@@ -161,20 +184,14 @@ Services_status(Matahari *matahari, const char *name, unsigned int timeout,
                 DBusGMethodInvocation *context)
 {
     GError* error = NULL;
-    svc_action_t *op;
-    int rc;
 
     if (!check_authorization(SERVICES_BUS_NAME ".status", &error, context)) {
         dbus_g_method_return_error(context, error);
         g_error_free(error);
         return FALSE;
     }
-    op = services_action_create(name, "status", 0, timeout);
-    services_action_sync(op);
-    rc = op->rc;
-    services_action_free(op);
-    dbus_g_method_return(context, rc);
-    return TRUE;
+    return services_action_reply_async(name, "status", timeout, context,
+                                       services_rc_cb);
 }
 
 gboolean
@@ -324,12 +341,51 @@ void invoke_cb(svc_action_t *op)
     free(cb_data);
 }
 
+static void
+get_metadata_cb(const char *xml, void *user_data)
+{
+    DBusGMethodInvocation *context = user_data;
+    GError* error = NULL;
+
+    if (xml == NULL) {
+        error = g_error_new(MATAHARI_ERROR, MH_RES_BACKEND_ERROR,
+                            "%s", mh_result_to_str(MH_RES_BACKEND_ERROR));
+        dbus_g_method_return_error(context, error);
+        g_error_free(error);
+        return;
+    }
+
+    dbus_g_method_return(context, xml);
+}
+
+gboolean
+Resources_get_metadata(Matahari *matahari, const char *standard,
+                       const char *provider, const char *agent,
+                       DBusGMethodInvocation *context)
+{
+    GError* error = NULL;
+
+    if (!check_authorization(RESOURCES_INTERFACE_NAME ".get_metadata",
+                             &error, context)) {
+        dbus_g_method_return_error(context, error);
+        g_error_free(error);
+        return FALSE;
+    }
+
+    if (!resources_get_metadata_async(standard, provider, agent,
+                                      get_metadata_cb, context)) {
+        get_metadata_cb(NULL, context);
+    }
+    return TRUE;
+}
+
 gboolean
 Resources_invoke(Matahari *matahari, const char *name, const char *standard,
                  const char *provider, const char *agent, const char *action,
                  unsigned int interval, GHashTable *parameters,
                  unsigned int timeout, unsigned int expected_rc,
-                 const char *userdata_in, DBusGMethodInvocation *context)
+                 const char *userdata_in, gboolean stream_output,
+                 DBusGMethodInvocation *context)
 {
     GError* error = NULL;
     svc_action_t *op = NULL;
@@ -374,6 +430,66 @@ Resources_invoke(Matahari *matahari, const char *name, const char *standard,
     return FALSE;
 }
 
+gboolean
+Resources_invoke_batch(Matahari *matahari, char **actions,
+                       gboolean stream_results, const char *userdata_in,
+                       DBusGMethodInvocation *context)
+{
+    GError* error = NULL;
+    if (!check_authorization(RESOURCES_INTERFACE_NAME ".invoke_batch",
+                             &error, context)) {
+        dbus_g_method_return_error(context, error);
+        g_error_free(error);
+        return FALSE;
+    }
+    // TODO: Lists of maps can't be expressed in the generated interface
+    error = g_error_new(MATAHARI_ERROR, MH_RES_NOT_IMPLEMENTED,
+                        "%s", mh_result_to_str(MH_RES_NOT_IMPLEMENTED));
+    dbus_g_method_return_error(context, error);
+    g_error_free(error);
+    return TRUE;
+}
+
+gboolean
+Resources_start_group(Matahari *matahari, char **services,
+                      unsigned int max_concurrent, unsigned int timeout,
+                      DBusGMethodInvocation *context)
+{
+    GError* error = NULL;
+    if (!check_authorization(RESOURCES_INTERFACE_NAME ".start_group",
+                             &error, context)) {
+        dbus_g_method_return_error(context, error);
+        g_error_free(error);
+        return FALSE;
+    }
+    // TODO: Lists of maps can't be expressed in the generated interface
+    error = g_error_new(MATAHARI_ERROR, MH_RES_NOT_IMPLEMENTED,
+                        "%s", mh_result_to_str(MH_RES_NOT_IMPLEMENTED));
+    dbus_g_method_return_error(context, error);
+    g_error_free(error);
+    return TRUE;
+}
+
+gboolean
+Resources_stop_group(Matahari *matahari, char **services,
+                     unsigned int max_concurrent, unsigned int timeout,
+                     DBusGMethodInvocation *context)
+{
+    GError* error = NULL;
+    if (!check_authorization(RESOURCES_INTERFACE_NAME ".stop_group",
+                             &error, context)) {
+        dbus_g_method_return_error(context, error);
+        g_error_free(error);
+        return FALSE;
+    }
+    // TODO: Lists of maps can't be expressed in the generated interface
+    error = g_error_new(MATAHARI_ERROR, MH_RES_NOT_IMPLEMENTED,
+                        "%s", mh_result_to_str(MH_RES_NOT_IMPLEMENTED));
+    dbus_g_method_return_error(context, error);
+    g_error_free(error);
+    return TRUE;
+}
+
 gboolean
 Resources_cancel(Matahari *matahari, const char *name, const char *action,
                  unsigned int interval, unsigned int timeout,
@@ -392,6 +508,115 @@ Resources_cancel(Matahari *matahari, const char *name, const char *action,
     return TRUE;
 }
 
+gboolean
+Resources_cancel_all(Matahari *matahari, const char *name,
+                     DBusGMethodInvocation *context)
+{
+    GError* error = NULL;
+    if (!check_authorization(RESOURCES_INTERFACE_NAME ".cancel_all",
+                             &error, context)) {
+        dbus_g_method_return_error(context, error);
+        g_error_free(error);
+        return FALSE;
+    }
+
+    dbus_g_method_return(context, services_action_cancel_all(name));
+    return TRUE;
+}
+
+gboolean
+Resources_list_recurring(Matahari *matahari, DBusGMethodInvocation *context)
+{
+    GError* error = NULL;
+    if (!check_authorization(RESOURCES_INTERFACE_NAME ".list_recurring",
+                             &error, context)) {
+        dbus_g_method_return_error(context, error);
+        g_error_free(error);
+        return FALSE;
+    }
+    // TODO: Lists of maps can't be expressed in the generated interface
+    error = g_error_new(MATAHARI_ERROR, MH_RES_NOT_IMPLEMENTED,
+                        "%s", mh_result_to_str(MH_RES_NOT_IMPLEMENTED));
+    dbus_g_method_return_error(context, error);
+    g_error_free(error);
+    return TRUE;
+}
+
+gboolean
+Resources_watch(Matahari *matahari, const char *name,
+                DBusGMethodInvocation *context)
+{
+    GError* error = NULL;
+    if (!check_authorization(RESOURCES_INTERFACE_NAME ".watch",
+                             &error, context)) {
+        dbus_g_method_return_error(context, error);
+        g_error_free(error);
+        return FALSE;
+    }
+    // TODO: Events are not delivered over D-Bus
+    error = g_error_new(MATAHARI_ERROR, MH_RES_NOT_IMPLEMENTED,
+                        "%s", mh_result_to_str(MH_RES_NOT_IMPLEMENTED));
+    dbus_g_method_return_error(context, error);
+    g_error_free(error);
+    return TRUE;
+}
+
+gboolean
+Resources_unwatch(Matahari *matahari, const char *name,
+                  DBusGMethodInvocation *context)
+{
+    GError* error = NULL;
+    if (!check_authorization(RESOURCES_INTERFACE_NAME ".unwatch",
+                             &error, context)) {
+        dbus_g_method_return_error(context, error);
+        g_error_free(error);
+        return FALSE;
+    }
+    // TODO: Events are not delivered over D-Bus
+    error = g_error_new(MATAHARI_ERROR, MH_RES_NOT_IMPLEMENTED,
+                        "%s", mh_result_to_str(MH_RES_NOT_IMPLEMENTED));
+    dbus_g_method_return_error(context, error);
+    g_error_free(error);
+    return TRUE;
+}
+
+gboolean
+Resources_history(Matahari *matahari, const char *name, unsigned int limit,
+                  DBusGMethodInvocation *context)
+{
+    GError* error = NULL;
+    if (!check_authorization(RESOURCES_INTERFACE_NAME ".history",
+                             &error, context)) {
+        dbus_g_method_return_error(context, error);
+        g_error_free(error);
+        return FALSE;
+    }
+    // TODO: Lists of maps can't be expressed in the generated interface
+    error = g_error_new(MATAHARI_ERROR, MH_RES_NOT_IMPLEMENTED,
+                        "%s", mh_result_to_str(MH_RES_NOT_IMPLEMENTED));
+    dbus_g_method_return_error(context, error);
+    g_error_free(error);
+    return TRUE;
+}
+
+gboolean
+Resources_get_agent_usage(Matahari *matahari, DBusGMethodInvocation *context)
+{
+    GError* error = NULL;
+    if (!check_authorization(RESOURCES_INTERFACE_NAME ".get_agent_usage",
+                             &error, context)) {
+        dbus_g_method_return_error(context, error);
+        g_error_free(error);
+        return FALSE;
+    }
+    // TODO: Lists of maps can't be expressed in the generated interface
+    error = g_error_new(MATAHARI_ERROR, MH_RES_NOT_IMPLEMENTED,
+                        "%s", mh_result_to_str(MH_RES_NOT_IMPLEMENTED));
+    dbus_g_method_return_error(context, error);
+    g_error_free(error);
+    return TRUE;
+}
+
 gboolean
 Resources_fail(Matahari *matahari, const char *name, unsigned int rc,
                          DBusGMethodInvocation *context)
@@ -429,6 +654,8 @@ void
 matahari_get_property(GObject *object, guint property_id, GValue *value,
                       GParamSpec *pspec)
 {
+    services_stats_t stats;
+
     switch ((enum Prop) property_id) {
     case PROP_0:
         // Just to silence warning
@@ -444,6 +671,22 @@ matahari_get_property(GObject *object, guint property_id, GValue *value,
     case PROP_SERVICES_QMF_GEN_NO_CRASH:
         // Not used in DBus module
         break;
+    case PROP_RESOURCES_QUEUED_ACTIONS:
+        services_get_stats(&stats);
+        g_value_set_uint (value, stats.queued);
+        break;
+    case PROP_RESOURCES_RUNNING_ACTIONS:
+        services_get_stats(&stats);
+        g_value_set_uint (value, stats.running);
+        break;
+    case PROP_RESOURCES_QUEUE_WAIT_AVG:
+        services_get_stats(&stats);
+        g_value_set_uint (value, stats.wait_avg);
+        break;
+    case PROP_RESOURCES_QUEUE_WAIT_MAX:
+        services_get_stats(&stats);
+        g_value_set_uint (value, stats.wait_max);
+        break;
     }
 }
 
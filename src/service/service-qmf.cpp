@@ -22,6 +22,7 @@
 #include <string.h>
 
 #include <string>
+#include <vector>
 #include <qpid/management/Manageable.h>
 #include <qpid/agent/ManagementAgent.h>
 #include "matahari/agent.h"
@@ -44,6 +45,9 @@ class SrvAgent : public MatahariAgent
 private:
     void action_async(enum service_id service, qmf::AgentSession& session,
                       qmf::AgentEvent& event, svc_action_t *op, bool has_rc);
+    void invoke_batch(qmf::AgentSession& session, qmf::AgentEvent& event);
+    void run_group(qmf::AgentSession& session, qmf::AgentEvent& event,
+                   bool stop);
 
     qmf::Data _services;
     static const char SERVICES_NAME[];
@@ -58,13 +62,39 @@ private:
 
     qmf::org::matahariproject::PackageDefinition _package;
 
+    /** Results waiting to be sent in a resource_ops event */
+    _qtype::Variant::List _pending_ops;
+    /** Source ID of the timer that sends _pending_ops */
+    guint _ops_timer;
+    /** Number of resource_ops events raised */
+    uint32_t _ops_sequence;
+
+    static gboolean ops_timeout(gpointer user_data);
+
 public:
+    SrvAgent() : _ops_timer(0), _ops_sequence(0) {};
+
     virtual int setup(qmf::AgentSession session);
     virtual gboolean invoke(qmf::AgentSession session,
                             qmf::AgentEvent event, gpointer user_data);
     void raiseEvent(svc_action_t *op, enum service_id service, const std::string &userdata);
+    void raiseOutputEvent(svc_action_t *op, const char *channel,
+                          const std::string &output, uint32_t chunk,
+                          uint32_t dropped, const std::string &userdata);
+    void flushEvents(void);
+    void raiseExitedEvent(const char *name, pid_t pid);
+    void updateStats(void);
 };
 
+/**
+ * How long changed results are collected before being sent together in a
+ * resource_ops event, in ms.  0 sends a resource_op event for each one.
+ */
+static unsigned int event_window = 0;
+
+/** Most results sent in one resource_ops event */
+#define OPS_PENDING_MAX 256
+
 const char SrvAgent::SERVICES_NAME[] = "Services";
 
 const char SrvAgent::RESOURCES_NAME[] = "Resources";
@@ -81,10 +111,21 @@ public:
             qmf::AgentSession& _session, qmf::AgentEvent& _event,
             bool _has_rc) :
             agent(_agent), service(_service), session(_session), event(_event),
-            has_rc(_has_rc), last_rc(0), first_result(true) {};
-    ~AsyncCB() {};
+            has_rc(_has_rc), last_rc(0), first_result(true), op(NULL),
+            chunk(0), output_timer(0) {
+        dropped[0] = dropped[1] = 0;
+    };
+    ~AsyncCB() {
+        if (output_timer) {
+            g_source_remove(output_timer);
+        }
+    };
 
     static void mh_async_callback(svc_action_t *op);
+    static void mh_output_callback(svc_action_t *op, gboolean is_stderr,
+                                   const char *data, size_t len);
+    static gboolean mh_output_timeout(gpointer user_data);
+    void flushOutput(void);
 
     /** Cached SrvAgent instance */
     SrvAgent *agent;
@@ -101,8 +142,85 @@ public:
     int last_rc;
     /** true if this is the first callback. */
     bool first_result;
+
+    /** The action, once it has produced output to stream */
+    svc_action_t *op;
+    /** Output not yet sent in a resource_output event, stdout and stderr */
+    std::string pending_output[2];
+    /** Bytes of output discarded since the last event, stdout and stderr */
+    uint32_t dropped[2];
+    /** Number of resource_output events raised for this action */
+    uint32_t chunk;
+    /** Source ID of the timer that sends pending output */
+    guint output_timer;
 };
 
+/** Minimum time between resource_output events for an action */
+#define OUTPUT_INTERVAL_MS 500
+/** Most output held for one resource_output event, per channel */
+#define OUTPUT_PENDING_MAX 16384
+
+void
+AsyncCB::mh_output_callback(svc_action_t *op, gboolean is_stderr,
+                            const char *data, size_t len)
+{
+    AsyncCB *cb_data = static_cast<AsyncCB *>(op->cb_data);
+    std::string &pending = cb_data->pending_output[is_stderr ? 1 : 0];
+
+    cb_data->op = op;
+    pending.append(data, len);
+
+    if (pending.length() > OUTPUT_PENDING_MAX) {
+        /* Keep the most recent lines */
+        size_t cut = pending.length() - OUTPUT_PENDING_MAX;
+        size_t eol = pending.find('\n', cut);
+
+        if (eol != std::string::npos && eol + 1 < pending.length()) {
+            cut = eol + 1;
+        }
+        pending.erase(0, cut);
+        cb_data->dropped[is_stderr ? 1 : 0] += cut;
+    }
+
+    if (cb_data->output_timer == 0) {
+        cb_data->output_timer = g_timeout_add(OUTPUT_INTERVAL_MS,
+                                              mh_output_timeout, cb_data);
+    }
+}
+
+gboolean
+AsyncCB::mh_output_timeout(gpointer user_data)
+{
+    AsyncCB *cb_data = static_cast<AsyncCB *>(user_data);
+
+    cb_data->output_timer = 0;
+    cb_data->flushOutput();
+    return FALSE;
+}
+
+void
+AsyncCB::flushOutput(void)
+{
+    static const char *channels[] = { "stdout", "stderr" };
+    std::string userdata;
+    int lpc;
+
+    qpid::types::Variant::Map& args = event.getArguments();
+    if (args.count("userdata") > 0) {
+        userdata = args["userdata"].asString();
+    }
+
+    for (lpc = 0; lpc < 2; lpc++) {
+        if (pending_output[lpc].empty() && dropped[lpc] == 0) {
+            continue;
+        }
+        agent->raiseOutputEvent(op, channels[lpc], pending_output[lpc],
+                                ++chunk, dropped[lpc], userdata);
+        pending_output[lpc].clear();
+        dropped[lpc] = 0;
+    }
+}
+
 void
 AsyncCB::mh_async_callback(svc_action_t *op)
 {
@@ -111,6 +229,15 @@ AsyncCB::mh_async_callback(svc_action_t *op)
 
     mh_trace("Completed: %s = %d", op->id, op->rc);
 
+    if (cb_data->op) {
+        /* Send the remaining output ahead of the result */
+        if (cb_data->output_timer) {
+            g_source_remove(cb_data->output_timer);
+            cb_data->output_timer = 0;
+        }
+        cb_data->flushOutput();
+    }
+
     qpid::types::Variant::Map& args = cb_data->event.getArguments();
     if (args.count("userdata") > 0) {
         userdata = args["userdata"].asString();
@@ -132,6 +259,8 @@ AsyncCB::mh_async_callback(svc_action_t *op)
         cb_data->agent->raiseEvent(op, cb_data->service, userdata);
     }
 
+    cb_data->agent->updateStats();
+
     if (op->interval) { /* recurring action */
         cb_data->last_rc = op->rc;
     } else {
@@ -140,6 +269,227 @@ AsyncCB::mh_async_callback(svc_action_t *op)
     }
 }
 
+/**
+ * Outstanding get_metadata call
+ *
+ * Replies once the agent's meta-data is available, which may mean running
+ * the agent.
+ */
+class MetadataCB {
+public:
+    MetadataCB(qmf::AgentSession& _session, qmf::AgentEvent& _event) :
+            session(_session), event(_event) {};
+    ~MetadataCB() {};
+
+    static void mh_metadata_callback(const char *xml, void *user_data);
+
+    /** The QMF session that initiated the call */
+    qmf::AgentSession session;
+    /** The method call waiting for the meta-data */
+    qmf::AgentEvent event;
+};
+
+void
+MetadataCB::mh_metadata_callback(const char *xml, void *user_data)
+{
+    MetadataCB *cb_data = static_cast<MetadataCB *>(user_data);
+
+    if (xml == NULL) {
+        cb_data->session.raiseException(cb_data->event,
+                                        mh_result_to_str(MH_RES_BACKEND_ERROR));
+    } else {
+        cb_data->event.addReturnArgument("xml", xml);
+        cb_data->session.methodSuccess(cb_data->event);
+    }
+
+    delete cb_data;
+}
+
+/**
+ * Outstanding invoke_batch call
+ *
+ * Collects the results of the batch's actions and replies once the last
+ * of them has completed.
+ */
+class BatchCB {
+public:
+    BatchCB(SrvAgent *_agent, qmf::AgentSession& _session,
+            qmf::AgentEvent& _event, size_t count, bool _stream) :
+            agent(_agent), session(_session), event(_event),
+            results(count), outstanding(1), stream(_stream) {};
+    ~BatchCB() {};
+
+    static void mh_batch_callback(svc_action_t *op);
+    void setResult(size_t index, svc_action_t *op);
+    void setError(size_t index, _qtype::Variant::Map& args,
+                  enum mh_result result);
+    void release(void);
+
+    /** Cached SrvAgent instance */
+    SrvAgent *agent;
+    /** The QMF session that initiated the batch */
+    qmf::AgentSession session;
+    /** The method call that initiated the batch */
+    qmf::AgentEvent event;
+    /** One result per action, in the order they were requested */
+    std::vector<_qtype::Variant::Map> results;
+    /** Actions still running, plus one until all have been submitted */
+    size_t outstanding;
+    /** Whether to raise a resource_op event as each action completes */
+    bool stream;
+};
+
+/** Callback data of an action that is part of a batch */
+struct BatchItem {
+    BatchCB *batch;
+    size_t index;
+};
+
+void
+BatchCB::setResult(size_t index, svc_action_t *op)
+{
+    _qtype::Variant::Map& result = results[index];
+    unsigned int wait_ms = 0;
+    unsigned int run_ms = 0;
+
+    services_action_get_timing(op, &wait_ms, &run_ms);
+
+    result["name"] = op->rsc;
+    result["action"] = op->action;
+    result["rc"] = op->rc;
+    result["status"] = op->status;
+    result["wait"] = wait_ms;
+    result["runtime"] = run_ms;
+}
+
+void
+BatchCB::setError(size_t index, _qtype::Variant::Map& args,
+                  enum mh_result res)
+{
+    _qtype::Variant::Map& result = results[index];
+
+    result["name"] = args["name"];
+    result["action"] = args["action"];
+    result["rc"] = OCF_UNKNOWN_ERROR;
+    result["status"] = LRM_OP_ERROR;
+    result["error"] = mh_result_to_str(res);
+}
+
+void
+BatchCB::release(void)
+{
+    _qtype::Variant::List list;
+    std::vector<_qtype::Variant::Map>::iterator iter;
+
+    if (--outstanding > 0) {
+        return;
+    }
+
+    for (iter = results.begin(); iter != results.end(); iter++) {
+        list.push_back(*iter);
+    }
+
+    _qtype::Variant::Map& args = event.getArguments();
+    event.addReturnArgument("results", list);
+    if (args.count("userdata") > 0) {
+        event.addReturnArgument("userdata", args["userdata"].asString());
+    }
+    session.methodSuccess(event);
+
+    agent->updateStats();
+    delete this;
+}
+
+void
+BatchCB::mh_batch_callback(svc_action_t *op)
+{
+    BatchItem *item = static_cast<BatchItem *>(op->cb_data);
+    BatchCB *batch = item->batch;
+
+    mh_trace("Completed: %s = %d (batch item %lu)", op->id, op->rc,
+             (unsigned long) item->index);
+
+    batch->setResult(item->index, op);
+
+    if (batch->stream) {
+        std::string userdata;
+        _qtype::Variant::Map& args = batch->event.getArguments();
+
+        if (args.count("userdata") > 0) {
+            userdata = args["userdata"].asString();
+        }
+        batch->agent->raiseEvent(op, SRV_RESOURCES, userdata);
+    }
+
+    delete item;
+    op->cb_data = NULL;
+    batch->release();
+}
+
+/**
+ * Outstanding start_group or stop_group call
+ */
+class GroupCB {
+public:
+    GroupCB(SrvAgent *_agent, qmf::AgentSession& _session,
+            qmf::AgentEvent& _event) :
+            agent(_agent), session(_session), event(_event) {};
+    ~GroupCB() {};
+
+    static void mh_group_callback(services_group_t *group, void *user_data);
+
+    /** Cached SrvAgent instance */
+    SrvAgent *agent;
+    /** The QMF session that initiated the group */
+    qmf::AgentSession session;
+    /** The method call that initiated the group */
+    qmf::AgentEvent event;
+};
+
+void
+GroupCB::mh_group_callback(services_group_t *group, void *user_data)
+{
+    GroupCB *cb_data = static_cast<GroupCB *>(user_data);
+    _qtype::Variant::List results;
+    _qtype::Variant::List path;
+    unsigned int elapsed_ms = 0;
+    unsigned int critical_ms = 0;
+    GList *list = NULL;
+    GList *gIter = NULL;
+
+    list = services_group_results(group);
+    for (gIter = list; gIter != NULL; gIter = gIter->next) {
+        const services_group_result_t *member =
+            (const services_group_result_t *) gIter->data;
+        _qtype::Variant::Map result;
+
+        result["name"] = member->name;
+        result["rc"] = member->rc;
+        result["status"] = member->status;
+        result["skipped"] = (bool) member->skipped;
+        result["start"] = member->start_ms;
+        result["runtime"] = member->run_ms;
+        results.push_back(result);
+    }
+    g_list_free(list);
+
+    services_group_timing(group, &elapsed_ms, &critical_ms, &list);
+    for (gIter = list; gIter != NULL; gIter = gIter->next) {
+        path.push_back((const char *) gIter->data);
+    }
+    g_list_free(list);
+
+    cb_data->event.addReturnArgument("results", results);
+    cb_data->event.addReturnArgument("elapsed", elapsed_ms);
+    cb_data->event.addReturnArgument("critical_path", path);
+    cb_data->event.addReturnArgument("critical_path_time", critical_ms);
+    cb_data->session.methodSuccess(cb_data->event);
+
+    cb_data->agent->updateStats();
+    services_group_free(group);
+    delete cb_data;
+}
+
 static GHashTable *
 qmf_map_to_hash(::qpid::types::Variant::Map parameters)
 {
@@ -156,11 +506,136 @@ qmf_map_to_hash(::qpid::types::Variant::Map parameters)
     return hash;
 }
 
+/**
+ * Create a resource action from the arguments of an invoke call
+ *
+ * \param[in]  args   name, standard, provider, agent, action, interval,
+ *                    timeout, parameters and expected-rc
+ * \param[out] result why no action could be created
+ *
+ * \return the action, or NULL
+ */
+static svc_action_t *
+resource_action_from_args(_qtype::Variant::Map& args, enum mh_result& result)
+{
+    svc_action_t *op = NULL;
+    _qtype::Variant::Map map;
+    GHashTable *params = NULL;
+    GList *standards = NULL;
+    gboolean known = FALSE;
+
+    int32_t interval = 0;
+    int32_t timeout = 60000;
+    std::string agent;
+    std::string standard("ocf");
+    std::string provider("heartbeat");
+
+    if (args.count("standard")) {
+        standard = args["standard"].asString();
+    }
+    if (args.count("provider")) {
+        provider = args["provider"].asString();
+    }
+    if (args.count("agent")) {
+        agent = args["agent"].asString();
+    } else {
+        agent = args["name"].asString();
+    }
+
+    if(args.count("interval") > 0) {
+        interval = args["interval"].asInt32();
+    }
+    if(args.count("timeout") > 0) {
+        timeout = args["timeout"].asInt32();
+    }
+
+    standards = resources_list_standards();
+    known = g_list_find_custom(standards, standard.c_str(),
+                               (GCompareFunc) strcasecmp) != NULL;
+    g_list_free_full(standards, free);
+
+    if (!known) {
+        mh_err("%s is not a known resource standard", standard.c_str());
+        result = MH_RES_NOT_IMPLEMENTED;
+        return NULL;
+    }
+
+    if(args.count("parameters") == 1) {
+        map = args["parameters"].asMap();
+    }
+
+    params = qmf_map_to_hash(map);
+    op = resources_action_create(
+        args["name"].asString().c_str(),
+        standard.c_str(), provider.c_str(), agent.c_str(),
+        args["action"].asString().c_str(),
+        interval, timeout, params);
+
+    if (op == NULL || op->params != params) {
+        /* Only OCF actions take ownership of their parameters */
+        g_hash_table_destroy(params);
+    }
+
+    if (!op) {
+        result = MH_RES_INVALID_ARGS;
+        return NULL;
+    }
+
+    if(args.count("expected-rc") == 1) {
+        op->expected_rc = args["expected-rc"].asInt32();
+    }
+
+    return op;
+}
+
+static int
+max_actions_option(int code, const char *name, const char *arg, void *userdata)
+{
+    services_set_max_concurrent(atoi(arg));
+    return 0;
+}
+
+static int
+result_ttl_option(int code, const char *name, const char *arg, void *userdata)
+{
+    services_set_result_ttl(atoi(arg));
+    return 0;
+}
+
+static int
+lsb_pidfiles_option(int code, const char *name, const char *arg, void *userdata)
+{
+    services_set_lsb_pidfile_status(TRUE);
+    return 0;
+}
+
+static int
+event_window_option(int code, const char *name, const char *arg, void *userdata)
+{
+    event_window = atoi(arg);
+    return 0;
+}
+
 int
 main(int argc, char **argv)
 {
     SrvAgent agent;
-    int rc = agent.init(argc, argv, "service");
+    int rc;
+
+    mh_add_option('m', required_argument, "max-actions",
+                  "maximum number of resource actions to execute at once",
+                  NULL, max_actions_option);
+    mh_add_option('R', required_argument, "result-ttl",
+                  "reuse status and monitor results for this many milliseconds",
+                  NULL, result_ttl_option);
+    mh_add_option('E', required_argument, "event-window",
+                  "send changed results together in one event every this many milliseconds",
+                  NULL, event_window_option);
+    mh_add_option('L', no_argument, "lsb-pidfiles",
+                  "answer LSB status from the service's pidfile when it is running",
+                  NULL, lsb_pidfiles_option);
+
+    rc = agent.init(argc, argv, "service");
 
     if (rc >= 0) {
         mainloop_track_children(G_PRIORITY_DEFAULT);
@@ -174,7 +649,8 @@ void
 SrvAgent::raiseEvent(svc_action_t *op, enum service_id service, const std::string &userdata)
 {
     uint64_t timestamp = 0L;
-    qmf::Data event;
+    _qtype::Variant::Map result;
+    services_usage_t usage;
 
 #ifdef HAVE_TIME
     timestamp = ::time(NULL);
@@ -183,25 +659,141 @@ SrvAgent::raiseEvent(svc_action_t *op, enum service_id service, const std::strin
     if (service == SRV_SERVICES) {
         // event = qmf::Data(_package.event_service_op);
         return;
+    }
+
+    result["name"] = op->rsc;
+    result["action"] = op->action;
+    result["interval"] = op->interval;
+    result["rc"] = op->rc;
+    result["timestamp"] = timestamp;
+    result["sequence"] = op->sequence;
+
+    if (service == SRV_RESOURCES) {
+        result["standard"] = op->standard;
+        if(op->provider) {
+            result["provider"] = op->provider;
+        }
+        result["agent"] = op->agent;
+        result["expected-rc"] = op->expected_rc;
+    }
+
+    if (userdata.length()) {
+        result["userdata"] = userdata;
+    }
+
+    services_action_get_usage(op, &usage);
+    result["wall_time"] = usage.wall_ms;
+    result["user_time"] = usage.user_ms;
+    result["system_time"] = usage.system_ms;
+    result["max_rss"] = usage.max_rss_kb;
+    result["read_bytes"] = usage.read_bytes;
+    result["write_bytes"] = usage.write_bytes;
+
+    if (event_window) {
+        _pending_ops.push_back(result);
+
+        if (_pending_ops.size() >= OPS_PENDING_MAX) {
+            flushEvents();
+
+        } else if (_ops_timer == 0) {
+            _ops_timer = g_timeout_add(event_window, ops_timeout, this);
+        }
+
     } else {
-        event = qmf::Data(_package.event_resource_op);
+        qmf::Data event(_package.event_resource_op);
+        _qtype::Variant::Map::iterator iter;
+
+        for (iter = result.begin(); iter != result.end(); iter++) {
+            event.setProperty(iter->first, iter->second);
+        }
+        getSession().raiseEvent(event);
     }
+}
+
+gboolean
+SrvAgent::ops_timeout(gpointer user_data)
+{
+    SrvAgent *agent = static_cast<SrvAgent *>(user_data);
+
+    agent->_ops_timer = 0;
+    agent->flushEvents();
+    return FALSE;
+}
+
+/**
+ * Send the results collected by raiseEvent() in a resource_ops event
+ */
+void
+SrvAgent::flushEvents(void)
+{
+    uint64_t timestamp = 0L;
+    qmf::Data event(_package.event_resource_ops);
+
+    if (_ops_timer) {
+        g_source_remove(_ops_timer);
+        _ops_timer = 0;
+    }
+
+    if (_pending_ops.empty()) {
+        return;
+    }
+
+#ifdef HAVE_TIME
+    timestamp = ::time(NULL);
+#endif
+
+    event.setProperty("timestamp", timestamp);
+    event.setProperty("sequence", ++_ops_sequence);
+    event.setProperty("count", (uint32_t) _pending_ops.size());
+    event.setProperty("results", _pending_ops);
+    getSession().raiseEvent(event);
+
+    _pending_ops.clear();
+}
+
+void
+SrvAgent::raiseExitedEvent(const char *name, pid_t pid)
+{
+    uint64_t timestamp = 0L;
+    qmf::Data event(_package.event_resource_exited);
+
+#ifdef HAVE_TIME
+    timestamp = ::time(NULL);
+#endif
+
+    event.setProperty("timestamp", timestamp);
+    event.setProperty("name", name);
+    event.setProperty("pid", (uint32_t) pid);
+    getSession().raiseEvent(event);
+}
+
+static void
+service_exited(const char *name, pid_t pid, void *user_data)
+{
+    static_cast<SrvAgent *>(user_data)->raiseExitedEvent(name, pid);
+}
+
+void
+SrvAgent::raiseOutputEvent(svc_action_t *op, const char *channel,
+                           const std::string &output, uint32_t chunk,
+                           uint32_t dropped, const std::string &userdata)
+{
+    uint64_t timestamp = 0L;
+    qmf::Data event(_package.event_resource_output);
+
+#ifdef HAVE_TIME
+    timestamp = ::time(NULL);
+#endif
 
     event.setProperty("name", op->rsc);
     event.setProperty("action", op->action);
     event.setProperty("interval", op->interval);
-    event.setProperty("rc", op->rc);
     event.setProperty("timestamp", timestamp);
     event.setProperty("sequence", op->sequence);
-
-    if (service == SRV_RESOURCES) {
-        event.setProperty("standard", op->standard);
-        if(op->provider) {
-            event.setProperty("provider", op->provider);
-        }
-        event.setProperty("agent", op->agent);
-        event.setProperty("expected-rc", op->expected_rc);
-    }
+    event.setProperty("chunk", chunk);
+    event.setProperty("channel", channel);
+    event.setProperty("output", output);
+    event.setProperty("dropped", dropped);
 
     if (userdata.length()) {
         event.setProperty("userdata", userdata);
@@ -210,6 +802,19 @@ SrvAgent::raiseEvent(svc_action_t *op, enum service_id service, const std::strin
     getSession().raiseEvent(event);
 }
 
+void
+SrvAgent::updateStats(void)
+{
+    services_stats_t stats;
+
+    services_get_stats(&stats);
+
+    _resources.setProperty("queued_actions", stats.queued);
+    _resources.setProperty("running_actions", stats.running);
+    _resources.setProperty("queue_wait_avg", stats.wait_avg);
+    _resources.setProperty("queue_wait_max", stats.wait_max);
+}
+
 int
 SrvAgent::setup(qmf::AgentSession session)
 {
@@ -227,6 +832,8 @@ SrvAgent::setup(qmf::AgentSession session)
     _resources.setProperty("uuid", mh_uuid());
     _resources.setProperty("hostname", mh_hostname());
 
+    updateStats();
+
     session.addData(_resources, RESOURCES_NAME);
 
     return 0;
@@ -258,6 +865,138 @@ SrvAgent::action_async(enum service_id service, qmf::AgentSession& session,
 {
     op->cb_data = new AsyncCB(this, service, session, event, has_rc);
     services_action_async(op, AsyncCB::mh_async_callback);
+    updateStats();
+}
+
+void
+SrvAgent::invoke_batch(qmf::AgentSession& session, qmf::AgentEvent& event)
+{
+    _qtype::Variant::Map& args = event.getArguments();
+    _qtype::Variant::List actions;
+    _qtype::Variant::List::iterator iter;
+    BatchCB *batch = NULL;
+    size_t index = 0;
+
+    if (args.count("actions") == 1) {
+        actions = args["actions"].asList();
+    }
+
+    batch = new BatchCB(this, session, event, actions.size(),
+                        args.count("stream_results") == 1
+                        && args["stream_results"].asBool());
+
+    for (iter = actions.begin(); iter != actions.end(); iter++, index++) {
+        enum mh_result result = MH_RES_INVALID_ARGS;
+        _qtype::Variant::Map action;
+        svc_action_t *op = NULL;
+
+        if (iter->getType() == _qtype::VAR_MAP) {
+            action = iter->asMap();
+            /* Batches only run one-shot actions */
+            action.erase("interval");
+            op = resource_action_from_args(action, result);
+        }
+
+        if (op == NULL) {
+            batch->setError(index, action, result);
+            continue;
+        }
+
+        BatchItem *item = new BatchItem;
+        item->batch = batch;
+        item->index = index;
+        op->cb_data = item;
+
+        batch->outstanding++;
+        if (services_action_async(op, BatchCB::mh_batch_callback) == FALSE) {
+            batch->outstanding--;
+            batch->setError(index, action, MH_RES_BACKEND_ERROR);
+            services_action_free(op);
+            delete item;
+        }
+    }
+
+    updateStats();
+
+    /* Replies straight away if every action already completed or failed */
+    batch->release();
+}
+
+void
+SrvAgent::run_group(qmf::AgentSession& session, qmf::AgentEvent& event,
+                    bool stop)
+{
+    _qtype::Variant::Map& args = event.getArguments();
+    _qtype::Variant::List services;
+    _qtype::Variant::List::iterator iter;
+    services_group_t *group = NULL;
+    GroupCB *cb_data = NULL;
+    unsigned int max_concurrent = 0;
+
+    if (args.count("services") == 1) {
+        services = args["services"].asList();
+    }
+    if (args.count("max_concurrent") == 1) {
+        max_concurrent = args["max_concurrent"].asUint32();
+    }
+
+    /* The constraints say what starts after what, so stop in reverse */
+    group = services_group_new(stop, max_concurrent);
+
+    for (iter = services.begin(); iter != services.end(); iter++) {
+        enum mh_result result = MH_RES_INVALID_ARGS;
+        _qtype::Variant::Map service;
+        _qtype::Variant::List after;
+        _qtype::Variant::List::iterator a_iter;
+        std::vector<std::string> names;
+        GList *after_names = NULL;
+        svc_action_t *op = NULL;
+        gboolean added;
+
+        if (iter->getType() == _qtype::VAR_MAP) {
+            service = iter->asMap();
+            service.erase("interval");
+            service["action"] = stop ? "stop" : "start";
+            if (service.count("timeout") == 0 && args.count("timeout") == 1) {
+                service["timeout"] = args["timeout"];
+            }
+            op = resource_action_from_args(service, result);
+        }
+
+        if (op == NULL) {
+            services_group_free(group);
+            session.raiseException(event, mh_result_to_str(result));
+            return;
+        }
+
+        if (service.count("after") == 1) {
+            after = service["after"].asList();
+        }
+        for (a_iter = after.begin(); a_iter != after.end(); a_iter++) {
+            names.push_back(a_iter->asString());
+        }
+        for (size_t lpc = 0; lpc < names.size(); lpc++) {
+            after_names = g_list_append(after_names,
+                                        (gpointer) names[lpc].c_str());
+        }
+
+        added = services_group_add(group, op, after_names);
+        g_list_free(after_names);
+
+        if (!added) {
+            services_group_free(group);
+            session.raiseException(event, mh_result_to_str(MH_RES_INVALID_ARGS));
+            return;
+        }
+    }
+
+    cb_data = new GroupCB(this, session, event);
+    if (services_group_run(group, GroupCB::mh_group_callback,
+                           cb_data) == FALSE) {
+        delete cb_data;
+        services_group_free(group);
+        session.raiseException(event, mh_result_to_str(MH_RES_INVALID_ARGS));
+    }
 }
 
 gboolean
@@ -381,73 +1120,149 @@ SrvAgent::invoke_resources(qmf::AgentSession session, qmf::AgentEvent event,
 
         event.addReturnArgument("agents", t_list);
 
-    } else if (methodName == "invoke") {
-        svc_action_t *op = NULL;
-        _qtype::Variant::List::iterator iter;
-        _qtype::Variant::Map map;
+    } else if (methodName == "get_metadata") {
+        MetadataCB *cb_data = new MetadataCB(session, event);
 
-        if(args.count("parameters") == 1) {
-            map = args["parameters"].asMap();
+        if (!resources_get_metadata_async(args["standard"].asString().c_str(),
+                                          args["provider"].asString().c_str(),
+                                          args["agent"].asString().c_str(),
+                                          MetadataCB::mh_metadata_callback,
+                                          cb_data)) {
+            delete cb_data;
+            session.raiseException(event, mh_result_to_str(MH_RES_BACKEND_ERROR));
         }
+        return TRUE;
 
-        GHashTable *params = qmf_map_to_hash(map);
-
-        int32_t interval = 0;
-        int32_t timeout = 60000;
-        std::string agent;
-        std::string standard("ocf");
-        std::string provider("heartbeat");
+    } else if (methodName == "invoke") {
+        enum mh_result result = MH_RES_SUCCESS;
+        svc_action_t *op = resource_action_from_args(args, result);
 
-        if (args.count("standard")) {
-            standard = args["standard"].asString();
-        }
-        if (args.count("provider")) {
-            provider = args["provider"].asString();
-        }
-        if (args.count("agent")) {
-            agent = args["agent"].asString();
-        } else {
-            agent = args["name"].asString();
+        if (!op) {
+            session.raiseException(event, mh_result_to_str(result));
+            return TRUE;
         }
 
-        if(args.count("interval") > 0) {
-            interval = args["interval"].asInt32();
+        /* Only one-shot actions, whose callback data lives until they finish */
+        if (op->interval == 0 && args.count("stream_output") == 1
+            && args["stream_output"].asBool()) {
+            services_action_stream_output(op, AsyncCB::mh_output_callback, 0);
         }
-        if(args.count("timeout") > 0) {
-            timeout = args["timeout"].asInt32();
+
+        action_async(SRV_RESOURCES, session, event, op, true);
+        return TRUE;
+
+    } else if (methodName == "invoke_batch") {
+        invoke_batch(session, event);
+        return TRUE;
+
+    } else if (methodName == "start_group" || methodName == "stop_group") {
+        run_group(session, event, methodName == "stop_group");
+        return TRUE;
+
+    } else if (methodName == "cancel") {
+        services_action_cancel(
+                args["name"].asString().c_str(),
+                args["action"].asString().c_str(),
+                args["interval"].asInt32());
+
+    } else if (methodName == "cancel_all") {
+        unsigned int cancelled = services_action_cancel_all(
+                args["name"].asString().c_str());
+
+        event.addReturnArgument("cancelled", cancelled);
+        updateStats();
+
+    } else if (methodName == "list_recurring") {
+        GList *gIter = NULL;
+        GList *actions = services_action_list_recurring();
+        _qtype::Variant::List a_list;
+
+        for (gIter = actions; gIter != NULL; gIter = gIter->next) {
+            svc_action_t *op = (svc_action_t *) gIter->data;
+            _qtype::Variant::Map action;
+
+            action["name"] = op->rsc;
+            action["action"] = op->action;
+            action["interval"] = op->interval;
+            action["timeout"] = op->timeout;
+            action["standard"] = op->standard;
+            if (op->provider) {
+                action["provider"] = op->provider;
+            }
+            action["agent"] = op->agent;
+            action["rc"] = op->rc;
+            a_list.push_back(action);
         }
+        g_list_free(actions);
 
-        GList *standards = resources_list_standards();
+        event.addReturnArgument("actions", a_list);
 
-        if (g_list_find_custom(standards, standard.c_str(), (GCompareFunc) strcasecmp) == NULL) {
-            mh_err("%s is not a known resource standard", standard.c_str());
-            session.raiseException(event, mh_result_to_str(MH_RES_NOT_IMPLEMENTED));
+    } else if (methodName == "watch") {
+        pid_t pid = services_watch(args["name"].asString().c_str(),
+                                   service_exited, this);
+        if (pid <= 0) {
+            session.raiseException(event, mh_result_to_str(MH_RES_BACKEND_ERROR));
             return TRUE;
         }
 
-        op = resources_action_create(
-            args["name"].asString().c_str(),
-            standard.c_str(), provider.c_str(), agent.c_str(),
-            args["action"].asString().c_str(),
-            interval, timeout, params);
+        event.addReturnArgument("pid", (uint32_t) pid);
 
-        if (!op) {
-            session.raiseException(event, mh_result_to_str(MH_RES_INVALID_ARGS));
-            return TRUE;
+    } else if (methodName == "unwatch") {
+        services_unwatch(args["name"].asString().c_str());
+
+    } else if (methodName == "history") {
+        services_history_t records[SERVICES_HISTORY_LENGTH];
+        unsigned int limit = 0;
+        unsigned int count, lpc;
+        _qtype::Variant::List r_list;
+
+        if (args.count("limit") > 0) {
+            limit = args["limit"].asUint32();
+        }
+        if (limit == 0 || limit > SERVICES_HISTORY_LENGTH) {
+            limit = SERVICES_HISTORY_LENGTH;
         }
 
-        if(args.count("expected-rc") == 1) {
-            op->expected_rc = args["expected-rc"].asInt32();
+        count = services_get_history(args["name"].asString().c_str(),
+                                     records, limit);
+
+        for (lpc = 0; lpc < count; lpc++) {
+            _qtype::Variant::Map result;
+
+            result["timestamp"] = records[lpc].timestamp;
+            result["action"] = records[lpc].action;
+            result["interval"] = records[lpc].interval;
+            result["rc"] = records[lpc].rc;
+            result["status"] = records[lpc].status;
+            result["duration"] = records[lpc].duration_ms;
+            result["stderr"] = records[lpc].stderr_tail;
+            r_list.push_back(result);
         }
 
-        action_async(SRV_RESOURCES, session, event, op, true);
-        return TRUE;
+        event.addReturnArgument("results", r_list);
 
-    } else if (methodName == "cancel") {
-        services_action_cancel(
-                args["name"].asString().c_str(),
-                args["action"].asString().c_str(),
-                args["interval"].asInt32());
+    } else if (methodName == "get_agent_usage") {
+        GList *gIter = NULL;
+        GList *usage = services_get_agent_usage();
+        _qtype::Variant::List a_list;
+
+        for (gIter = usage; gIter != NULL; gIter = gIter->next) {
+            services_agent_usage_t *totals = (services_agent_usage_t *) gIter->data;
+            _qtype::Variant::Map agent;
+
+            agent["agent"] = totals->agent;
+            agent["actions"] = totals->actions;
+            agent["wall_time"] = totals->wall_ms;
+            agent["user_time"] = totals->user_ms;
+            agent["system_time"] = totals->system_ms;
+            agent["max_rss"] = totals->max_rss_kb;
+            agent["read_bytes"] = totals->read_bytes;
+            agent["write_bytes"] = totals->write_bytes;
+            a_list.push_back(agent);
+        }
+        services_agent_usage_free(usage);
+
+        event.addReturnArgument("agents", a_list);
 
     } else {
         session.raiseException(event, mh_result_to_str(MH_RES_NOT_IMPLEMENTED));
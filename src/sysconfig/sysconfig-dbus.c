@@ -46,9 +46,16 @@ void result_cb(void *data, int result)
     struct AsyncCBData *asynccb = (struct AsyncCBData *) data;
     char *status;
 
-    status = mh_sysconfig_is_configured(asynccb->key);
-    dbus_g_method_return(asynccb->context, status);
-    free(status);
+    if (result < 0) {
+        GError *error = g_error_new(MATAHARI_ERROR, -result,
+                                    mh_result_to_str(-result));
+        dbus_g_method_return_error(asynccb->context, error);
+        g_error_free(error);
+    } else {
+        status = mh_sysconfig_is_configured(asynccb->key);
+        dbus_g_method_return(asynccb->context, status);
+        free(status);
+    }
     free(asynccb->key);
     free(asynccb);
 }
@@ -140,6 +147,96 @@ Sysconfig_query(Matahari* matahari, const char *text, uint flags,
     return TRUE;
 }
 
+static void
+free_gvalue(gpointer data)
+{
+    g_value_unset((GValue *) data);
+    g_free(data);
+}
+
+/**
+ * \internal
+ * \brief Reply with the results of query_batch or match
+ */
+static gboolean
+return_values(DBusGMethodInvocation *context, enum mh_result res,
+              GHashTable *values)
+{
+    GHashTable *reply = NULL;
+    GHashTableIter iter;
+    gpointer path, value;
+
+    if (res != MH_RES_SUCCESS) {
+        GError *error = g_error_new(MATAHARI_ERROR, res, mh_result_to_str(res));
+        dbus_g_method_return_error(context, error);
+        g_error_free(error);
+        return FALSE;
+    }
+
+    /* The keys remain owned by values */
+    reply = g_hash_table_new_full(g_str_hash, g_str_equal, NULL, free_gvalue);
+    g_hash_table_iter_init(&iter, values);
+    while (g_hash_table_iter_next(&iter, &path, &value)) {
+        GValue *v = g_new0(GValue, 1);
+
+        g_value_init(v, G_TYPE_STRING);
+        g_value_set_string(v, value);
+        g_hash_table_insert(reply, path, v);
+    }
+
+    dbus_g_method_return(context, reply);
+
+    g_hash_table_destroy(reply);
+    g_hash_table_destroy(values);
+    return TRUE;
+}
+
+gboolean
+Sysconfig_query_batch(Matahari* matahari, char **paths, uint flags,
+                      const char *scheme, DBusGMethodInvocation *context)
+{
+    GError* error = NULL;
+    GHashTable *values = NULL;
+    GList *queries = NULL;
+    enum mh_result res;
+    int lpc;
+
+    if (!check_authorization(SYSCONFIG_BUS_NAME ".query_batch", &error,
+            context)) {
+        dbus_g_method_return_error(context, error);
+        g_error_free(error);
+        return FALSE;
+    }
+
+    for (lpc = 0; paths && paths[lpc]; lpc++) {
+        queries = g_list_prepend(queries, (gpointer) paths[lpc]);
+    }
+    queries = g_list_reverse(queries);
+
+    res = mh_sysconfig_query_batch(queries, flags, scheme, &values);
+    g_list_free(queries);
+
+    return return_values(context, res, values);
+}
+
+gboolean
+Sysconfig_match(Matahari* matahari, const char *pattern, uint flags,
+                const char *scheme, DBusGMethodInvocation *context)
+{
+    GError* error = NULL;
+    GHashTable *values = NULL;
+    enum mh_result res;
+
+    if (!check_authorization(SYSCONFIG_BUS_NAME ".match", &error, context)) {
+        dbus_g_method_return_error(context, error);
+        g_error_free(error);
+        return FALSE;
+    }
+
+    res = mh_sysconfig_match(pattern, flags, scheme, &values);
+    return return_values(context, res, values);
+}
+
 gboolean
 Sysconfig_is_configured(Matahari* matahari, const char *key,
                         DBusGMethodInvocation *context)
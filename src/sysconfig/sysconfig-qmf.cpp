@@ -96,6 +96,13 @@ AsyncCB::result_cb(void *cb_data, int res)
     AsyncCB *action_data = static_cast<AsyncCB *>(cb_data);
     char *status;
 
+    if (res < 0) {
+        action_data->session.raiseException(action_data->event,
+                mh_result_to_str((enum mh_result) -res));
+        delete action_data;
+        return;
+    }
+
     status = mh_sysconfig_is_configured(action_data->key.c_str());
     action_data->event.addReturnArgument("status", status ? status : "unknown");
 
@@ -148,6 +155,46 @@ ConfigAgent::invoke(qmf::AgentSession session, qmf::AgentEvent event, gpointer u
                                   args["scheme"].asString().c_str());
         event.addReturnArgument("data", data ? data : "unknown");
         free(data);
+    } else if (methodName == "query_batch" || methodName == "match") {
+        GHashTable *values = NULL;
+        GHashTableIter iter;
+        gpointer path, value;
+        qpid::types::Variant::Map result;
+        mh_result res;
+
+        if (methodName == "query_batch") {
+            GList *queries = NULL;
+            qpid::types::Variant::List &paths = args["paths"].asList();
+
+            for (qpid::types::Variant::List::iterator it = paths.begin();
+                 it != paths.end(); it++) {
+                queries = g_list_prepend(queries, strdup(it->asString().c_str()));
+            }
+            queries = g_list_reverse(queries);
+
+            res = mh_sysconfig_query_batch(queries, args["flags"].asUint32(),
+                                           args["scheme"].asString().c_str(),
+                                           &values);
+            g_list_free_full(queries, free);
+        } else {
+            res = mh_sysconfig_match(args["pattern"].asString().c_str(),
+                                     args["flags"].asUint32(),
+                                     args["scheme"].asString().c_str(),
+                                     &values);
+        }
+
+        if (res != MH_RES_SUCCESS) {
+            session.raiseException(event, mh_result_to_str(res));
+            goto bail;
+        }
+
+        g_hash_table_iter_init(&iter, values);
+        while (g_hash_table_iter_next(&iter, &path, &value)) {
+            result[(const char *) path] = (const char *) value;
+        }
+        g_hash_table_destroy(values);
+
+        event.addReturnArgument("values", result);
     } else if (methodName == "is_configured") {
         status = mh_sysconfig_is_configured(args["key"].asString().c_str());
         event.addReturnArgument("status", status ? status : "unknown");
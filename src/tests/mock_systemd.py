@@ -0,0 +1,141 @@
+#!/usr/bin/env python
+
+"""
+  mock_systemd.py - Copyright (c) 2012 Red Hat, Inc.
+
+  A minimal stand-in for org.freedesktop.systemd1, used to test the
+  systemd backend of the services API without touching real units.
+
+  usage: mock_systemd.py <bus address> <unit> [<unit> ...]
+
+  Units whose name starts with "failing" report a failed job when
+  started or stopped.  Jobs for units whose name starts with "instant"
+  complete, and are reported as removed, before the method that queued
+  them returns.
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this library; if not, write to the
+  Free Software Foundation, Inc.,
+  51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+"""
+
+import sys
+import dbus
+import dbus.service
+import dbus.mainloop.glib
+import gobject
+
+BUS_NAME = 'org.freedesktop.systemd1'
+OBJECT_PATH = '/org/freedesktop/systemd1'
+MANAGER_IFACE = BUS_NAME + '.Manager'
+UNIT_IFACE = BUS_NAME + '.Unit'
+
+
+class Unit(dbus.service.Object):
+    def __init__(self, bus, name, index, load_state='loaded'):
+        self.name = name
+        self.path = dbus.ObjectPath('%s/unit/%d' % (OBJECT_PATH, index))
+        self.load_state = load_state
+        self.active_state = 'inactive'
+        dbus.service.Object.__init__(self, bus, self.path)
+
+    @dbus.service.method(dbus.PROPERTIES_IFACE,
+                         in_signature='ss', out_signature='v')
+    def Get(self, iface, prop):
+        return self.GetAll(iface)[prop]
+
+    @dbus.service.method(dbus.PROPERTIES_IFACE,
+                         in_signature='s', out_signature='a{sv}')
+    def GetAll(self, iface):
+        return { 'Id': self.name,
+                 'LoadState': self.load_state,
+                 'ActiveState': self.active_state }
+
+
+class Manager(dbus.service.Object):
+    def __init__(self, bus, names):
+        dbus.service.Object.__init__(self, bus, OBJECT_PATH)
+        self.bus = bus
+        self.jobs = 0
+        self.units = {}
+        for name in names:
+            self.units[name] = Unit(bus, name, len(self.units))
+
+    def _queue_job(self, name, state):
+        if name not in self.units or self.units[name].load_state == 'not-found':
+            raise dbus.exceptions.DBusException(
+                'Unit %s not loaded.' % name,
+                name=BUS_NAME + '.NoSuchUnit')
+
+        self.jobs += 1
+        job = dbus.ObjectPath('%s/job/%d' % (OBJECT_PATH, self.jobs))
+        if name.startswith('instant'):
+            # JobRemoved goes out ahead of the method reply
+            self._finish_job(self.jobs, job, name, state)
+        else:
+            gobject.timeout_add(100, self._finish_job, self.jobs, job, name, state)
+        return job
+
+    def _finish_job(self, job_id, job, name, state):
+        result = 'done'
+        if name.startswith('failing'):
+            result = 'failed'
+        else:
+            self.units[name].active_state = state
+        self.JobRemoved(job_id, job, name, result)
+        return False
+
+    @dbus.service.method(MANAGER_IFACE)
+    def Subscribe(self):
+        pass
+
+    @dbus.service.method(MANAGER_IFACE, in_signature='s', out_signature='o')
+    def LoadUnit(self, name):
+        if name not in self.units:
+            # Keep it, exporting the same path twice would fail
+            self.units[name] = Unit(self.bus, name, len(self.units), 'not-found')
+        return self.units[name].path
+
+    @dbus.service.method(MANAGER_IFACE, in_signature='ss', out_signature='o')
+    def StartUnit(self, name, mode):
+        return self._queue_job(name, 'active')
+
+    @dbus.service.method(MANAGER_IFACE, in_signature='ss', out_signature='o')
+    def StopUnit(self, name, mode):
+        return self._queue_job(name, 'inactive')
+
+    @dbus.service.method(MANAGER_IFACE, out_signature='a(ssssssouso)')
+    def ListUnits(self):
+        units = []
+        for unit in self.units.values():
+            if unit.load_state == 'not-found':
+                continue
+            sub_state = 'dead'
+            if unit.active_state == 'active':
+                sub_state = 'running'
+            units.append((unit.name, 'mock unit', unit.load_state,
+                          unit.active_state, sub_state, '', unit.path,
+                          dbus.UInt32(0), '', dbus.ObjectPath('/')))
+        return units
+
+    @dbus.service.signal(MANAGER_IFACE, signature='uoss')
+    def JobRemoved(self, job_id, job, unit, result):
+        pass
+
+
+if __name__ == '__main__':
+    dbus.mainloop.glib.DBusGMainLoop(set_as_default=True)
+    bus = dbus.bus.BusConnection(sys.argv[1])
+    name = dbus.service.BusName(BUS_NAME, bus)
+    manager = Manager(bus, sys.argv[2:])
+    gobject.MainLoop().run()
@@ -0,0 +1,237 @@
+/*
+ * Copyright (C) 2012 Red Hat, Inc.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+/**
+ * \file
+ * \brief Spawn rate benchmark for the services library launch paths
+ *
+ * Launches a command repeatedly the way services_linux.c does, using
+ * each of the available strategies, and prints launches per second:
+ *
+ *   fork-close     fork() and close() every descriptor up to getdtablesize()
+ *   fork-range     fork() and a single close_range()
+ *   posix-spawn    posix_spawnp() with posix_spawn_file_actions_addclosefrom_np()
+ *
+ * Build and run with:
+ *
+ *   gcc -O2 -o spawn_benchmark spawn_benchmark.c
+ *   ./spawn_benchmark [-n launches] [-l fd-limit] [-f open-fds]
+ *                     [-m resident-MB] [command]
+ *
+ * The defaults (2000 launches of /bin/true, a 20000 descriptor limit,
+ * 200 open descriptors and 50MB of resident memory) approximate a busy
+ * matahari agent.  Raising the descriptor limit above the hard limit
+ * requires root.
+ */
+
+#define _GNU_SOURCE
+
+#include <sys/types.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <spawn.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+extern char **environ;
+
+typedef int (*launch_fn)(char **argv);
+
+static void
+close_loop(void)
+{
+    int lpc;
+
+    for (lpc = getdtablesize() - 1; lpc > STDERR_FILENO; lpc--) {
+        close(lpc);
+    }
+}
+
+static int
+launch_fork_close(char **argv)
+{
+    pid_t pid = fork();
+
+    switch (pid) {
+    case -1:
+        return errno;
+    case 0:
+        setpgid(0, 0);
+        close_loop();
+        execvp(argv[0], argv);
+        _exit(127);
+    default:
+        return waitpid(pid, NULL, 0) < 0 ? errno : 0;
+    }
+}
+
+static int
+launch_fork_range(char **argv)
+{
+    pid_t pid = fork();
+
+    switch (pid) {
+    case -1:
+        return errno;
+    case 0:
+        setpgid(0, 0);
+#ifdef SYS_close_range
+        if (syscall(SYS_close_range, STDERR_FILENO + 1, ~0U, 0) != 0)
+#endif
+        {
+            close_loop();
+        }
+        execvp(argv[0], argv);
+        _exit(127);
+    default:
+        return waitpid(pid, NULL, 0) < 0 ? errno : 0;
+    }
+}
+
+static int
+launch_posix_spawn(char **argv)
+{
+    int rc;
+    pid_t pid = 0;
+    posix_spawnattr_t attr;
+    posix_spawn_file_actions_t file_actions;
+
+    posix_spawnattr_init(&attr);
+    posix_spawn_file_actions_init(&file_actions);
+
+    posix_spawnattr_setpgroup(&attr, 0);
+    posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETPGROUP);
+#if defined(__GLIBC__) && (__GLIBC__ > 2 || __GLIBC_MINOR__ >= 34)
+    posix_spawn_file_actions_addclosefrom_np(&file_actions,
+                                             STDERR_FILENO + 1);
+#endif
+
+    rc = posix_spawnp(&pid, argv[0], &file_actions, &attr, argv, environ);
+
+    posix_spawn_file_actions_destroy(&file_actions);
+    posix_spawnattr_destroy(&attr);
+
+    if (rc == 0 && waitpid(pid, NULL, 0) < 0) {
+        rc = errno;
+    }
+    return rc;
+}
+
+static double
+now(void)
+{
+    struct timeval tv;
+
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec + tv.tv_usec / 1000000.0;
+}
+
+static void
+run(const char *name, launch_fn launch, char **argv, int launches)
+{
+    int lpc, rc;
+    double start = now(), elapsed;
+
+    for (lpc = 0; lpc < launches; lpc++) {
+        if ((rc = launch(argv)) != 0) {
+            fprintf(stderr, "%s: launch failed: %s\n", name, strerror(rc));
+            return;
+        }
+    }
+
+    elapsed = now() - start;
+    printf("%-12s %6d launches in %7.3fs: %8.1f launches/s\n",
+           name, launches, elapsed, launches / elapsed);
+}
+
+int
+main(int argc, char **argv)
+{
+    int opt, lpc;
+    int launches = 2000;
+    int fd_limit = 20000;
+    int open_fds = 200;
+    int resident_mb = 50;
+    char *default_argv[] = { "/bin/true", NULL };
+    char **cmd = default_argv;
+    struct rlimit rl;
+    char *ballast;
+
+    while ((opt = getopt(argc, argv, "n:l:f:m:")) != -1) {
+        switch (opt) {
+        case 'n':
+            launches = atoi(optarg);
+            break;
+        case 'l':
+            fd_limit = atoi(optarg);
+            break;
+        case 'f':
+            open_fds = atoi(optarg);
+            break;
+        case 'm':
+            resident_mb = atoi(optarg);
+            break;
+        default:
+            fprintf(stderr, "Usage: %s [-n launches] [-l fd-limit] "
+                    "[-f open-fds] [-m resident-MB] [command [args]]\n",
+                    argv[0]);
+            return 1;
+        }
+    }
+    if (optind < argc) {
+        cmd = argv + optind;
+    }
+
+    rl.rlim_cur = rl.rlim_max = fd_limit;
+    if (setrlimit(RLIMIT_NOFILE, &rl) != 0) {
+        perror("setrlimit(RLIMIT_NOFILE)");
+        if (getrlimit(RLIMIT_NOFILE, &rl) == 0 && rl.rlim_cur < rl.rlim_max) {
+            rl.rlim_cur = rl.rlim_max;
+            setrlimit(RLIMIT_NOFILE, &rl);
+        }
+    }
+
+    for (lpc = 0; lpc < open_fds; lpc++) {
+        if (open("/dev/null", O_RDONLY) < 0) {
+            perror("open(/dev/null)");
+            break;
+        }
+    }
+
+    /* Touch every page so the parent really has this much resident */
+    ballast = malloc((size_t) resident_mb * 1024 * 1024);
+    if (ballast) {
+        memset(ballast, 1, (size_t) resident_mb * 1024 * 1024);
+    }
+
+    printf("%s: fd limit %d, %d open fds, %dMB resident\n",
+           cmd[0], getdtablesize(), open_fds, resident_mb);
+
+    run("fork-close", launch_fork_close, cmd, launches);
+    run("fork-range", launch_fork_range, cmd, launches);
+    run("posix-spawn", launch_posix_spawn, cmd, launches);
+
+    free(ballast);
+    return 0;
+}
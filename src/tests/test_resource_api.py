@@ -22,6 +22,7 @@
 
 import commands as cmd
 import matahariTest as testUtil
+from nose.plugins.skip import SkipTest
 from qmf2 import QmfAgentException
 import unittest
 import time
@@ -55,11 +56,116 @@ class TestResourceApi(unittest.TestCase):
         value = qmf.props.get('hostname')
         self.assertEquals(value, cmd.getoutput("hostname"), "hostname not matching")
 
+    # TEST - queue statistics
+    # =====================================================
+    def test_queue_statistics(self):
+        connection.reQuery()
+        for stat in ('queued_actions', 'running_actions',
+                     'queue_wait_avg', 'queue_wait_max'):
+            self.assertNotEquals(qmf.props.get(stat), None, stat + " missing")
+        self.assertEquals(qmf.props.get('running_actions'), 0, "actions still running while idle")
+
     # TEST - fail()
     # =====================================================
     def test_fail_not_implemented(self):
         self.assertRaises(QmfAgentException, qmf.fail, "crond", 0)
 
+    # TEST - invoke_batch()
+    # =====================================================
+    def test_invoke_batch(self):
+        actions = [ { 'name': 'crond', 'standard': 'lsb', 'agent': 'crond',
+                      'action': 'status', 'timeout': 10000 },
+                    { 'name': 'bogus', 'standard': 'nosuchstandard',
+                      'action': 'status' } ]
+        results = qmf.invoke_batch(actions, False, 'batch').get('results')
+        self.assertEquals(len(results), 2, "one result per action expected")
+        self.assertEquals(results[0]['name'], 'crond', "results out of order")
+        for key in ('rc', 'status', 'wait', 'runtime'):
+            self.assertTrue(key in results[0], key + " missing from result")
+        self.assertTrue('error' in results[1], "invalid action not reported")
+
+    # TEST - start_group() / stop_group()
+    # =====================================================
+    def test_group_cycle(self):
+        services = [ { 'name': 'a', 'standard': 'lsb', 'agent': 'crond', 'after': ['b'] },
+                     { 'name': 'b', 'standard': 'lsb', 'agent': 'crond', 'after': ['a'] } ]
+        self.assertRaises(QmfAgentException, qmf.start_group, services, 0, 10000)
+        self.assertRaises(QmfAgentException, qmf.stop_group, services, 0, 10000)
+
+    def test_group_unknown_dependency(self):
+        services = [ { 'name': 'a', 'standard': 'lsb', 'agent': 'crond',
+                       'after': ['no-such-service'] } ]
+        self.assertRaises(QmfAgentException, qmf.start_group, services, 0, 10000)
+
+    def test_group_empty(self):
+        result = qmf.start_group([], 0, 10000)
+        self.assertEquals(result.get('results'), [], "results of empty group")
+        self.assertEquals(result.get('critical_path'), [], "critical path of empty group")
+
+    # TEST - list_recurring() / cancel_all()
+    # =====================================================
+    def test_cancel_all(self):
+        name = 'crond-recurring'
+        for action in ('status', 'monitor'):
+            qmf.invoke(name, 'lsb', '', 'crond', action, 60000, {}, 10000, 0, '')
+
+        recurring = [ a for a in qmf.list_recurring().get('actions')
+                      if a['name'] == name ]
+        self.assertEquals(len(recurring), 2, "recurring actions not listed")
+
+        self.assertEquals(qmf.cancel_all(name).get('cancelled'), 2,
+                          "recurring actions not cancelled")
+        recurring = [ a for a in qmf.list_recurring().get('actions')
+                      if a['name'] == name ]
+        self.assertEquals(len(recurring), 0, "cancelled actions still listed")
+
+    # TEST - history()
+    # =====================================================
+    def test_history(self):
+        name = 'crond-history'
+        for action in ('status', 'monitor'):
+            qmf.invoke(name, 'lsb', '', 'crond', action, 0, {}, 10000, 0, '')
+
+        results = qmf.history(name, 0).get('results')
+        self.assertEquals([ r['action'] for r in results ], ['monitor', 'status'],
+                          "results not returned newest first")
+        for key in ('timestamp', 'interval', 'rc', 'status', 'duration', 'stderr'):
+            self.assertTrue(key in results[0], key + " missing from result")
+        self.assertEquals(len(qmf.history(name, 1).get('results')), 1,
+                          "limit not applied")
+        self.assertEquals(qmf.history('no-such-resource', 0).get('results'), [],
+                          "history of unknown resource not empty")
+
+    # TEST - watch()
+    # =====================================================
+    def test_watch_unknown_service(self):
+        self.assertRaises(QmfAgentException, qmf.watch, "no-such-service")
+
+    # TEST - get_agent_usage()
+    # =====================================================
+    def test_get_agent_usage(self):
+        qmf.invoke('crond', 'lsb', '', 'crond', 'status', 0, {}, 10000, 0, '')
+        usage = dict([ (a['agent'], a) for a in qmf.get_agent_usage().get('agents') ])
+        self.assertTrue('lsb:crond' in usage, "agent usage not recorded")
+        self.assertTrue(usage['lsb:crond']['actions'] >= 1, "action not counted")
+        for key in ('wall_time', 'user_time', 'system_time', 'max_rss',
+                    'read_bytes', 'write_bytes'):
+            self.assertTrue(key in usage['lsb:crond'], key + " missing from usage")
+
+    # TEST - get_metadata()
+    # =====================================================
+    def test_get_metadata(self):
+        agents = qmf.list('ocf', 'heartbeat').get('agents')
+        if not agents:
+            raise SkipTest("no OCF heartbeat agents installed")
+        first = qmf.get_metadata('ocf', 'heartbeat', agents[0]).get('xml')
+        self.assertTrue('<resource-agent' in first, "meta-data not returned")
+        second = qmf.get_metadata('ocf', 'heartbeat', agents[0]).get('xml')
+        self.assertEquals(first, second, "cached meta-data differs")
+
+    def test_get_metadata_unknown_agent(self):
+        self.assertRaises(QmfAgentException, qmf.get_metadata, 'ocf', 'heartbeat', 'NoSuchAgent')
+
     # TEST - describe()
     # =====================================================
     def test_describe_not_implemented(self):
@@ -108,6 +108,23 @@ class TestServiceApi(unittest.TestCase):
                 except ValueError:
                     self.fail("QMF service %s missing" % str(svc))
 
+    def test_list_follows_changes(self):
+        path = "/etc/init.d/matahari-list-test"
+        qmf.list()
+        try:
+            cmd.getoutput("echo 'exit 0' > " + path)
+            cmd.getoutput("chmod 755 " + path)
+            self.assertTrue("matahari-list-test" in qmf.list().get("agents"),
+                            "new service not listed")
+
+            cmd.getoutput("chmod 644 " + path)
+            self.assertFalse("matahari-list-test" in qmf.list().get("agents"),
+                             "non-executable service still listed")
+        finally:
+            cmd.getoutput("rm -f " + path)
+        self.assertFalse("matahari-list-test" in qmf.list().get("agents"),
+                         "removed service still listed")
+
 
     # TEST - disable()
     # =====================================================
@@ -39,6 +39,7 @@ import threading
 import SimpleHTTPServer
 import SocketServer
 import errno
+import hashlib
 from nose.plugins.attrib import attr
 
 
@@ -46,6 +47,9 @@ from nose.plugins.attrib import attr
 # can't seem to make it work, so screw it, randomize the port.
 HTTP_PORT = 49002 + random.randint(0, 500)
 
+# Requests for paths under /slow are answered after this many seconds
+SLOW_HTTP_DELAY = 10
+
 err = sys.stderr
 testPuppetFile = "/sysconfig-puppet-test"
 testAugeasFile = "/sysconfig-augeas-test"
@@ -54,6 +58,7 @@ testPuppetFileWithPath = testPath + testPuppetFile
 testAugeasFileWithPath = testPath + testAugeasFile
 testPuppetFileUrl = ("http://127.0.0.1:%d" % HTTP_PORT) + testPuppetFile
 testAugeasFileUrl = ("http://127.0.0.1:%d" % HTTP_PORT) + testAugeasFile
+cacheDir = "/var/lib/matahari/sysconfig-cache/"
 targetFilePerms = '440'
 targetFileGroup = 'root'
 targetFileOwner = 'root'
@@ -108,6 +113,48 @@ def checkFile(file, perms, owner, grp):
     return count
 
 
+class CountingHTTPHandler(SimpleHTTPServer.SimpleHTTPRequestHandler):
+    """ Serves files with an ETag, honouring If-None-Match, and counts
+    requests and full transfers per path (including the query string).
+    Paths under /slow are served like the rest of the path, but only after
+    stalling for SLOW_HTTP_DELAY seconds """
+    requests = {}
+    transfers = {}
+
+    def do_GET(self):
+        counts = CountingHTTPHandler.requests
+        counts[self.path] = counts.get(self.path, 0) + 1
+        if self.path.startswith('/slow/'):
+            time.sleep(SLOW_HTTP_DELAY)
+            self.path = self.path[len('/slow'):]
+        self.etag = None
+        try:
+            st = os.stat(self.translate_path(self.path))
+        except OSError:
+            return SimpleHTTPServer.SimpleHTTPRequestHandler.do_GET(self)
+
+        self.etag = '"%x-%x"' % (int(st.st_mtime * 1000000), st.st_size)
+        if self.headers.get('If-None-Match') == self.etag:
+            self.send_response(304)
+            self.end_headers()
+            return
+
+        counts = CountingHTTPHandler.transfers
+        counts[self.path] = counts.get(self.path, 0) + 1
+        return SimpleHTTPServer.SimpleHTTPRequestHandler.do_GET(self)
+
+    def end_headers(self):
+        if self.etag:
+            self.send_header('ETag', self.etag)
+        SimpleHTTPServer.SimpleHTTPRequestHandler.end_headers(self)
+
+
+class ThreadingHTTPServer(SocketServer.ThreadingMixIn, SocketServer.TCPServer):
+    """ Handles each request in its own thread, so a stalled one does not
+    hold up the rest """
+    daemon_threads = True
+
+
 class HTTPThread(threading.Thread):
     def run(self):
         try:
@@ -116,8 +163,8 @@ class HTTPThread(threading.Thread):
             if e.errno != errno.EEXIST:
                 raise
         os.chdir(testPath)
-        self.handler = SimpleHTTPServer.SimpleHTTPRequestHandler
-        self.httpd = SocketServer.TCPServer(("", HTTP_PORT), self.handler)
+        self.handler = CountingHTTPHandler
+        self.httpd = ThreadingHTTPServer(("", HTTP_PORT), self.handler)
         sys.stderr.write("Starting HTTP Server on port: %d ...\n" % HTTP_PORT)
         self.httpd.serve_forever()
 
@@ -232,6 +279,39 @@ class TestSysconfigApi(unittest.TestCase):
             self.assertRaises(DBusException, wrapper, dbus, 'uri', testPuppetFileUrl, 0, 'schema', testUtil.getRandomKey(5))
             self.assertTrue( 0 == checkFile(testPuppetFileWithPath, origFilePerms, origFileOwner, origFileGroup), "DBus: file properties not expected")
 
+    def test_run_uri_unchanged_file_not_downloaded_again(self):
+        resetTestFile(testPuppetFileWithPath, origFilePerms, origFileOwner, origFileGroup, puppetFileContents)
+        path = testPuppetFile + "?" + testUtil.getRandomKey(8)
+        url = ("http://127.0.0.1:%d" % HTTP_PORT) + path
+
+        for i in range(2):
+            results = qmf.run_uri(url, 0, 'puppet', testUtil.getRandomKey(5))
+            self.assertEqual(results.get('status'), 'OK', "QMF result: %s != OK" % results.get('status'))
+        self.assertEqual(CountingHTTPHandler.requests.get(path), 2, "QMF: file not revalidated")
+        self.assertEqual(CountingHTTPHandler.transfers.get(path), 1, "QMF: unchanged file downloaded again")
+
+        resetTestFile(testPuppetFileWithPath, origFilePerms, origFileOwner, origFileGroup, puppetFileContents + "\n")
+        results = qmf.run_uri(url, 0, 'puppet', testUtil.getRandomKey(5))
+        self.assertEqual(results.get('status'), 'OK', "QMF result: %s != OK" % results.get('status'))
+        self.assertEqual(CountingHTTPHandler.transfers.get(path), 2, "QMF: changed file not downloaded")
+        self.assertTrue(0 == checkFile(testPuppetFileWithPath, targetFilePerms, targetFileOwner, targetFileGroup), "QMF: file properties not expected")
+
+    def test_run_uri_changed_file_replaces_cached_copy(self):
+        oldContents = puppetFileContents + "\n# " + testUtil.getRandomKey(8) + "\n"
+        oldObject = cacheDir + hashlib.sha256(oldContents).hexdigest()
+        path = testPuppetFile + "?" + testUtil.getRandomKey(8)
+        url = ("http://127.0.0.1:%d" % HTTP_PORT) + path
+
+        resetTestFile(testPuppetFileWithPath, origFilePerms, origFileOwner, origFileGroup, oldContents)
+        results = qmf.run_uri(url, 0, 'puppet', testUtil.getRandomKey(5))
+        self.assertEqual(results.get('status'), 'OK', "QMF result: %s != OK" % results.get('status'))
+        self.assertTrue(os.path.exists(oldObject), "QMF: download not cached")
+
+        resetTestFile(testPuppetFileWithPath, origFilePerms, origFileOwner, origFileGroup, puppetFileContents + "\n")
+        results = qmf.run_uri(url, 0, 'puppet', testUtil.getRandomKey(5))
+        self.assertEqual(results.get('status'), 'OK', "QMF result: %s != OK" % results.get('status'))
+        self.assertFalse(os.path.exists(oldObject), "QMF: stale cached copy not removed")
+
     # TODO: need to handle upstream vs rhel difference
 
     # TEST - Augeas
@@ -375,6 +455,71 @@ class TestSysconfigApi(unittest.TestCase):
             result = dbus.query('bad augeas query', 0, 'augeas')
             self.assertEqual(result, 'unknown', "DBus result: %s != unknown" % result)
 
+    @attr('augeas')
+    def test_query_sees_changed_file_augeas(self):
+        # Shellvars loads /etc/sysconfig/*, so augeas can both read and write this
+        name = "/etc/sysconfig/matahari-test-" + testUtil.getRandomKey(5)
+        query = "/files%s/VALUE" % name
+        testUtil.setFileContents(name, "VALUE=one\n")
+        try:
+            result = qmf.query(query, 0, 'augeas').get('data')
+            self.assertEqual(result, 'one', "QMF result: %s != one" % result)
+
+            results = qmf.run_string("set %s two\nsave\n" % query, 0, 'augeas',
+                                     testUtil.getRandomKey(5)).get('status')
+            self.assertEqual(results.split('\n')[0], 'OK', "QMF: set failed: %s" % results)
+
+            result = qmf.query(query, 0, 'augeas').get('data')
+            self.assertEqual(result, 'two', "QMF: stale result %s != two" % result)
+        finally:
+            cmd.getoutput("rm -f %s %s.augsave" % (name, name))
+
+    @attr('augeas')
+    def test_query_union_augeas(self):
+        expected = qmf.query(augeasQuery, 0, 'augeas').get('data')
+        other = "/files/etc/passwd/root/uid"
+        values = qmf.match("%s | %s" % (augeasQuery, other), 0, 'augeas').get('values')
+        self.assertEqual(values.get(augeasQuery), expected, "QMF result: %s != %s" % (values.get(augeasQuery), expected))
+        self.assertEqual(values.get(other), '0', "QMF: other side of the union missing")
+
+    # TEST - query_batch()
+    # ================================================================
+    @attr('augeas')
+    def test_query_batch_augeas(self):
+        expected = qmf.query(augeasQuery, 0, 'augeas').get('data')
+        values = qmf.query_batch([augeasQuery, 'bad augeas query'], 0, 'augeas').get('values')
+        self.assertEqual(values.get(augeasQuery), expected, "QMF result: %s != %s" % (values.get(augeasQuery), expected))
+        self.assertFalse('bad augeas query' in values, "QMF: bad query has a result")
+
+        if testUtil.haveDBus:
+            values = dbus.query_batch([augeasQuery, 'bad augeas query'], 0, 'augeas')
+            self.assertEqual(values.get(augeasQuery), expected, "DBus result: %s != %s" % (values.get(augeasQuery), expected))
+            self.assertFalse('bad augeas query' in values, "DBus: bad query has a result")
+
+    def test_query_batch_non_schema(self):
+        self.assertRaises(QmfAgentException, qmf.query_batch, [augeasQuery], 0, 'schema')
+
+        if testUtil.haveDBus:
+            self.assertRaises(DBusException, dbus.query_batch, [augeasQuery], 0, 'schema')
+
+    # TEST - match()
+    # ================================================================
+    @attr('augeas')
+    def test_match_augeas(self):
+        expected = qmf.query(augeasQuery, 0, 'augeas').get('data')
+        pattern = augeasQuery.replace('/1/', '/*/')
+        values = qmf.match(pattern, 0, 'augeas').get('values')
+        self.assertEqual(values.get(augeasQuery), expected, "QMF result: %s != %s" % (values.get(augeasQuery), expected))
+
+        if testUtil.haveDBus:
+            values = dbus.match(pattern, 0, 'augeas')
+            self.assertEqual(values.get(augeasQuery), expected, "DBus result: %s != %s" % (values.get(augeasQuery), expected))
+
+    @attr('augeas')
+    def test_match_nothing_augeas(self):
+        values = qmf.match('/files/nonexistent/*', 0, 'augeas').get('values')
+        self.assertEqual(len(values), 0, "QMF result: %s is not empty" % values)
+
     # TEST - is_configured()
     # ================================================================
     def test_is_configured_known_key(self):
@@ -397,6 +542,32 @@ class TestSysconfigApi(unittest.TestCase):
             results = dbus.is_configured(testUtil.getRandomKey(5))
             self.assertTrue( str(results) == 'unknown', "DBus result: " + str(results) + " != unknown")
 
+    def test_is_configured_during_slow_download(self):
+        resetTestFile(testPuppetFileWithPath, origFilePerms, origFileOwner, origFileGroup, puppetFileContents)
+        url = ("http://127.0.0.1:%d/slow" % HTTP_PORT) + testPuppetFile
+        key = testUtil.getRandomKey(5)
+        results = {}
+
+        def download():
+            results['status'] = qmf.run_uri(url, 0, 'puppet', key).get('status')
+
+        started = time.time()
+        download_thread = threading.Thread(target=download)
+        download_thread.start()
+        try:
+            # Give the agent time to start on the download
+            time.sleep(1)
+            status = qmf.is_configured(testUtil.getRandomKey(5)).get('status')
+            elapsed = time.time() - started
+            self.assertEqual(status, 'unknown', "QMF result: %s != unknown" % status)
+            self.assertTrue(elapsed < SLOW_HTTP_DELAY / 2,
+                            "QMF: is_configured() took %.1fs behind a stalled download" % elapsed)
+        finally:
+            download_thread.join()
+
+        self.assertEqual(results.get('status'), 'OK', "QMF result: %s != OK" % results.get('status'))
+        self.assertTrue(time.time() - started >= SLOW_HTTP_DELAY, "QMF: download was not stalled")
+
     def test_is_configured_failed_key(self):
         key = testUtil.getRandomKey(5)
         wrapper(qmf, 'string', "bad puppet manifest", 0, 'puppet', key)
@@ -0,0 +1,122 @@
+#!/usr/bin/env python
+
+"""
+  test_systemd_api.py - Copyright (c) 2012 Red Hat, Inc.
+
+  Exercises the systemd standard of the Resources API against
+  mock_systemd.py running on a private bus, so no real units are touched.
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this library; if not, write to the
+  Free Software Foundation, Inc.,
+  51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+"""
+
+import matahariTest as testUtil
+from nose.plugins.skip import SkipTest
+import subprocess
+import unittest
+import time
+import sys
+import os
+
+connection = None
+qmf = None
+bus = None
+mock = None
+
+OCF_OK = 0
+OCF_UNKNOWN_ERROR = 1
+OCF_NOT_INSTALLED = 5
+LSB_STATUS_NOT_RUNNING = 3
+LSB_STATUS_NOT_INSTALLED = 4
+
+# Initialization
+# =====================================================
+def setUpModule():
+    global connection, qmf, bus, mock
+
+    # The systemd standard is only offered when systemctl is installed
+    if not os.path.isfile("/bin/systemctl"):
+        raise SkipTest("systemctl not installed")
+
+    bus = subprocess.Popen(["dbus-daemon", "--session", "--nofork",
+                            "--print-address"],
+                           stdout=subprocess.PIPE)
+    address = bus.stdout.readline().strip()
+
+    mock = subprocess.Popen([sys.executable,
+                             os.path.join(os.path.dirname(__file__),
+                                          "mock_systemd.py"),
+                             address, "mockd.service", "failing.service",
+                             "instant.service"])
+    time.sleep(1)
+
+    # Inherited by the agent started below
+    os.environ["DBUS_SYSTEM_BUS_ADDRESS"] = address
+
+    connection = SystemdTestsSetup()
+    qmf = connection.qmf
+
+def tearDownModule():
+    if connection:
+        connection.tearDown()
+    if mock:
+        mock.terminate()
+    if bus:
+        bus.terminate()
+
+class SystemdTestsSetup(testUtil.TestsSetup):
+    def __init__(self):
+        testUtil.TestsSetup.__init__(self, "matahari-qmf-serviced", "service", "Resources")
+
+def invoke(agent, action):
+    result = qmf.invoke(agent, "systemd", "", agent, action, 0, {}, 10000, 0, "")
+    return result.get("rc")
+
+class TestSystemdApi(unittest.TestCase):
+
+    # TEST - list()
+    # =====================================================
+    def test_list(self):
+        agents = qmf.list("systemd", "").get("agents")
+        self.assertEquals(sorted(agents), ["failing", "instant", "mockd"],
+                          "systemd units not listed from D-Bus")
+
+    # TEST - invoke() start/status/stop
+    # =====================================================
+    def test_start_stop(self):
+        self.assertEquals(invoke("mockd", "start"), OCF_OK, "start failed")
+        self.assertEquals(invoke("mockd", "status"), OCF_OK,
+                          "unit not active after start")
+        self.assertEquals(invoke("mockd", "stop"), OCF_OK, "stop failed")
+        self.assertEquals(invoke("mockd", "status"), LSB_STATUS_NOT_RUNNING,
+                          "unit still active after stop")
+
+    def test_job_removed_before_reply(self):
+        self.assertEquals(invoke("instant", "start"), OCF_OK,
+                          "job completed before its reply not reported")
+        self.assertEquals(invoke("instant", "status"), OCF_OK,
+                          "unit not active after start")
+        self.assertEquals(invoke("instant", "stop"), OCF_OK,
+                          "job completed before its reply not reported")
+
+    def test_failed_job(self):
+        self.assertEquals(invoke("failing", "start"), OCF_UNKNOWN_ERROR,
+                          "failed job not reported")
+
+    def test_unknown_unit(self):
+        self.assertEquals(invoke("nosuchunit", "start"), OCF_NOT_INSTALLED,
+                          "unknown unit not reported as not installed")
+        self.assertEquals(invoke("nosuchunit", "status"), LSB_STATUS_NOT_INSTALLED,
+                          "unknown unit not reported as not installed")
@@ -0,0 +1,126 @@
+#ifndef __MH_API_SERVICES_UNITTEST_H
+#define __MH_API_SERVICES_UNITTEST_H
+
+#include <cstring>
+#include <string>
+#include <cxxtest/TestSuite.h>
+
+extern "C" {
+#include "matahari/mainloop.h"
+#include "matahari/services.h"
+};
+
+using namespace std;
+
+static GMainLoop *services_loop = NULL;
+static int queued_status = -1;
+
+static void
+queued_done(svc_action_t *op)
+{
+    queued_status = op->status;
+}
+
+static void
+running_done(svc_action_t *op)
+{
+    g_main_loop_quit(services_loop);
+}
+
+static std::string completed;
+static svc_action_t *late_normal = NULL;
+
+static void
+ordered_done(svc_action_t *op)
+{
+    completed += op->action;
+    completed += " ";
+    if (strcmp(op->action, "monitor") == 0) {
+        g_main_loop_quit(services_loop);
+    }
+}
+
+static void
+busy_done(svc_action_t *op)
+{
+    /* The slot has just been freed, with the urgent action still queued */
+    TS_ASSERT(services_action_async(late_normal, ordered_done));
+}
+
+class MhApiServicesSuite : public CxxTest::TestSuite
+{
+public:
+    /**
+     * A one-shot action cancelled while waiting for an execution slot must
+     * still be completed, or whoever is waiting for its callback hangs.
+     */
+    void testCancelQueuedAction(void)
+    {
+        const char *args[] = { NULL };
+        svc_action_t *running = mh_services_action_create_generic("/bin/true", args);
+        svc_action_t *queued = mh_services_action_create_generic("/bin/true", args);
+
+        running->id = strdup("unittest-running_start_0");
+        running->timeout = 10000;
+        queued->id = strdup("unittest-queued_start_0");
+        queued->timeout = 10000;
+
+        mainloop_track_children(G_PRIORITY_DEFAULT);
+        services_set_max_concurrent(1);
+
+        TS_ASSERT(services_action_async(running, running_done));
+        TS_ASSERT(services_action_async(queued, queued_done));
+        TS_ASSERT_EQUALS(queued_status, -1);
+
+        TS_ASSERT(services_action_cancel("unittest-queued", "start", 0));
+        TS_ASSERT_EQUALS(queued_status, LRM_OP_CANCELLED);
+
+        services_loop = g_main_loop_new(NULL, FALSE);
+        g_main_loop_run(services_loop);
+        g_main_loop_unref(services_loop);
+        services_loop = NULL;
+
+        services_set_max_concurrent(0);
+    }
+
+    /**
+     * A new action must not take a free execution slot while actions of a
+     * higher priority are queued for it.
+     */
+    void testUrgentActionStartsFirst(void)
+    {
+        const char *args[] = { NULL };
+        svc_action_t *busy = mh_services_action_create_generic("/bin/true", args);
+        svc_action_t *urgent = mh_services_action_create_generic("/bin/true", args);
+
+        late_normal = mh_services_action_create_generic("/bin/true", args);
+
+        busy->id = strdup("unittest-busy_status_0");
+        busy->action = strdup("status");
+        busy->timeout = 10000;
+        urgent->id = strdup("unittest-urgent_start_0");
+        urgent->action = strdup("start");
+        urgent->timeout = 10000;
+        late_normal->id = strdup("unittest-normal_monitor_0");
+        late_normal->action = strdup("monitor");
+        late_normal->timeout = 10000;
+
+        mainloop_track_children(G_PRIORITY_DEFAULT);
+        services_set_max_concurrent(1);
+        completed.clear();
+
+        TS_ASSERT(services_action_async(busy, busy_done));
+        TS_ASSERT(services_action_async(urgent, ordered_done));
+
+        services_loop = g_main_loop_new(NULL, FALSE);
+        g_main_loop_run(services_loop);
+        g_main_loop_unref(services_loop);
+        services_loop = NULL;
+
+        TS_ASSERT_EQUALS(completed, "start monitor ");
+
+        services_set_max_concurrent(0);
+    }
+};
+
+#endif